@@ -43,6 +43,29 @@
 #define USISR_1bit ((1 << USISIF) | (1 << USIOIF) | (1 << USIPF) | (1 << USIDC) | (0xE << USICNT0))
 
 
+// True for fast mode (400kHz) and false for standard mode (100kHz)
+static bool bUSIFast;
+
+// Clock out the bits with the given low and high delays.
+// Written as a macro so that each speed has its own loop with
+// exact cycle counts.
+#define USI_CLOCK_BITS( delayLow, delayHigh )                               \
+    do                                                                      \
+    {                                                                       \
+        delayLow;                                                           \
+                                                                            \
+        /* Generate positive SCL edge. */                                   \
+        USICR = data;                                                       \
+                                                                            \
+        /* Wait for SCL to go high. */                                      \
+        while (!(PIN_USI & (1 << PIN_USI_SCL)) && !i2cTimedOut());          \
+                                                                            \
+        delayHigh;                                                          \
+                                                                            \
+        /* Generate negative SCL edge. */                                   \
+        USICR = data;                                                       \
+    } while (!(USISR & (1 << USIOIF))) /* Check for transfer complete. */
+
 /*---------------------------------------------------------------
  USI TWI single master initialization function
 ---------------------------------------------------------------*/
@@ -76,21 +99,14 @@ static uint8_t USI_TWI_Master_Transfer(uint8_t data)
            (1 << USIWM1) | (0 << USIWM0) |                 // Set USI in Two-wire mode.
            (1 << USICS1) | (0 << USICS0) | (1 << USICLK) | // Software clock strobe as source.
            (1 << USITC);                                   // Toggle Clock Port.
-    do
+    if( bUSIFast )
     {
-        DELAY_T2TWI;
-
-        // Generate positve SCL edge.
-        USICR = data;
-
-        // Wait for SCL to go high.
-        while (!(PIN_USI & (1 << PIN_USI_SCL)));
-
-        DELAY_T4TWI;
-
-        // Generate negative SCL edge.
-        USICR = data;
-    } while (!(USISR & (1 << USIOIF))); // Check for transfer complete.
+        USI_CLOCK_BITS( DELAY_FAST_LOW, DELAY_FAST_HIGH );
+    }
+    else
+    {
+        USI_CLOCK_BITS( DELAY_STD_LOW, DELAY_STD_HIGH );
+    }
 
     DELAY_T2TWI;
 
@@ -107,13 +123,15 @@ static uint8_t USI_TWI_Master_Transfer(uint8_t data)
     return data;
 }
 
-static void USI_TWI_Start()
+// Generate a start (or repeated start) condition.
+// Returns true if the start condition was detected on the bus.
+static bool USI_TWI_Start()
 {
     // Release SCL to ensure that (repeated) Start can be performed
     PORT_USI |= (1 << PIN_USI_SCL);
 
     // Verify that SCL becomes high.
-    while (!(PIN_USI & (1 << PIN_USI_SCL)));
+    while (!(PIN_USI & (1 << PIN_USI_SCL)) && !i2cTimedOut());
 
     DELAY_T2TWI;
 
@@ -127,22 +145,28 @@ static void USI_TWI_Start()
 
     // Release SDA.
     PORT_USI |= (1 << PIN_USI_SDA);
+
+    return (USISR & (1 << USISIF));
 }
 
-static void USI_TWI_Read( uint8_t *pData)
+// Read a byte then ACK it if more are to follow or NACK it
+// to confirm the end of transmission
+static void USI_TWI_Read( uint8_t *pData, bool bAck )
 {
     // Enable SDA as input.
     DDR_USI &= ~(1 << PIN_USI_SDA);
     *pData = USI_TWI_Master_Transfer(USISR_8bit);
 
-    // Load NACK to confirm End Of Transmission.
-    USIDR = 0xFF;
+    // Load ACK or NACK.
+    USIDR = bAck ? 0x00 : 0xFF;
 
     // Generate ACK/NACK.
     USI_TWI_Master_Transfer(USISR_1bit);
 }
 
-static void USI_TWI_Write( uint8_t data)
+// Write a byte.
+// Returns true if the slave ACKed it.
+static bool USI_TWI_Write( uint8_t data)
 {
     // Pull SCL LOW.
     PORT_USI &= ~(1 << PIN_USI_SCL);
@@ -155,7 +179,7 @@ static void USI_TWI_Write( uint8_t data)
 
     /* Clock and verify (N)ACK from slave */
     DDR_USI &= ~(1 << PIN_USI_SDA); // Enable SDA as input.
-    USI_TWI_Master_Transfer(USISR_1bit);
+    return !(USI_TWI_Master_Transfer(USISR_1bit) & (1 << TWI_NACK_BIT));
 }
 
 
@@ -172,7 +196,7 @@ static uint8_t USI_TWI_Master_Stop(void)
     PORT_USI |= (1 << PIN_USI_SCL);
 
     // Wait for SCL to go high.
-    while (!(PIN_USI & (1 << PIN_USI_SCL)));
+    while (!(PIN_USI & (1 << PIN_USI_SCL)) && !i2cTimedOut());
 
     DELAY_T4TWI;
 
@@ -184,31 +208,118 @@ static uint8_t USI_TWI_Master_Stop(void)
     return (true);
 }
 
+// Open drain control of the pins for bus recovery.
+// The port bits are low so setting the direction to output
+// pulls the line low and setting it to input releases it.
+#define I2C_SCL_LOW()       (DDR_USI |= (1 << PIN_USI_SCL))
+#define I2C_SCL_RELEASE()   (DDR_USI &= ~(1 << PIN_USI_SCL))
+#define I2C_SDA_LOW()       (DDR_USI |= (1 << PIN_USI_SDA))
+#define I2C_SDA_RELEASE()   (DDR_USI &= ~(1 << PIN_USI_SDA))
+#define I2C_SCL_HIGH()      (PIN_USI & (1 << PIN_USI_SCL))
+#define I2C_SDA_HIGH()      (PIN_USI & (1 << PIN_USI_SDA))
+
+// Take the pins away from the USI so they can be driven directly
+static void i2cDisable()
+{
+    USICR = 0;
+    PORT_USI &= ~((1 << PIN_USI_SDA) | (1 << PIN_USI_SCL));
+    I2C_SCL_RELEASE();
+    I2C_SDA_RELEASE();
+}
+
+// Give the pins back to the USI
+static void i2cEnable()
+{
+    USI_TWI_Master_Initialise();
+}
+
+// The USI supports standard and fast mode. Anything above
+// standard mode uses fast mode.
+static uint16_t i2cClockSetting( uint32_t hz )
+{
+    return hz > 100000;
+}
+
+static void i2cApplyClockSetting( uint16_t setting )
+{
+    bUSIFast = setting;
+}
+
 void i2cInit()
 {
     USI_TWI_Master_Initialise();
+    i2cSetClock( I2C_CLOCK_RATE );
 }
 
-uint8_t i2cWriteRegister(uint8_t addr, uint8_t reg, uint8_t data)
+// Write with the register address if pReg is not null
+static uint8_t i2cWriteBlock(uint8_t addr, const uint8_t *pReg, const uint8_t *buf, uint8_t len)
 {
-    USI_TWI_Start();
-    USI_TWI_Write( (addr << TWI_ADR_BITS) | (0 << TWI_READ_BIT) );
-    USI_TWI_Write( reg );
-    USI_TWI_Write( data );
+    uint8_t result = 0;
+    uint8_t i;
+
+    if( !USI_TWI_Start() )
+    {
+        result = 1;
+    }
+    else if( !USI_TWI_Write( (addr << TWI_ADR_BITS) | (0 << TWI_READ_BIT) ) )
+    {
+        result = 2;
+    }
+    else if( pReg && !USI_TWI_Write( *pReg ) )
+    {
+        result = 3;
+    }
+    else
+    {
+        // The device auto-increments the register address after each byte
+        for( i = 0 ; i < len ; i++ )
+        {
+            if( !USI_TWI_Write( buf[i] ) )
+            {
+                result = 4;
+                break;
+            }
+        }
+    }
     USI_TWI_Master_Stop(); // Send a STOP condition on the TWI bus.
 
-    return 0;
+    return result;
 }
 
-uint8_t i2cReadRegister(uint8_t addr, uint8_t reg, uint8_t *data)
+static uint8_t i2cReadBlock(uint8_t addr, uint8_t startReg, uint8_t *buf, uint8_t len)
 {
-    USI_TWI_Start();
-    USI_TWI_Write( (addr << TWI_ADR_BITS) | (0 << TWI_READ_BIT) );
-    USI_TWI_Write( reg );
-    USI_TWI_Start();
-    USI_TWI_Write( (addr << TWI_ADR_BITS) | (1 << TWI_READ_BIT) );
-    USI_TWI_Read( data );
+    uint8_t result = 0;
+    uint8_t i;
+
+    if( !USI_TWI_Start() )
+    {
+        result = 1;
+    }
+    else if( !USI_TWI_Write( (addr << TWI_ADR_BITS) | (0 << TWI_READ_BIT) ) )
+    {
+        result = 2;
+    }
+    else if( !USI_TWI_Write( startReg ) )
+    {
+        result = 3;
+    }
+    else if( !USI_TWI_Start() )
+    {
+        result = 4;
+    }
+    else if( !USI_TWI_Write( (addr << TWI_ADR_BITS) | (1 << TWI_READ_BIT) ) )
+    {
+        result = 5;
+    }
+    else
+    {
+        // ACK every byte except the last
+        for( i = 0 ; i < len ; i++ )
+        {
+            USI_TWI_Read( &buf[i], i < (len - 1) );
+        }
+    }
     USI_TWI_Master_Stop(); // Send a STOP condition on the TWI bus.
 
-    return 0;
+    return result;
 }
@@ -30,10 +30,52 @@
 #endif
 //********** Defines **********//
 
-#define TWI_US_DELAY (F_CPU/1000000)
+// Bus timing. The USI is clocked by software so the delays are counted
+// in CPU cycles. Both standard mode (100kHz) and fast mode (400kHz)
+// are supported. The low period is the minimum allowed and the high
+// period makes up the rest of the clock period.
+#define TWI_CYCLES(ns) ((F_CPU / 1000000UL * (ns) + 999) / 1000)
 
-#define DELAY_T2TWI (__builtin_avr_delay_cycles(2*TWI_US_DELAY))
-#define DELAY_T4TWI (__builtin_avr_delay_cycles(1*TWI_US_DELAY))
+#define TWI_STD_LOW     TWI_CYCLES(4700)
+#define TWI_STD_HIGH    TWI_CYCLES(5300)
+#define TWI_FAST_LOW    TWI_CYCLES(1300)
+#define TWI_FAST_HIGH   TWI_CYCLES(1200)
+
+// Cycles taken by the transfer loop itself during the low and
+// high parts of each clock. These are the fewest the loop in
+// USI_CLOCK_BITS can take so the periods are never shorter than the
+// minimum. Any extra cycles the compiler adds only make them longer.
+//
+// Low: from the out that gives the negative SCL edge
+//      sbis USISR,USIOIF   1   transfer not complete so no skip
+//      rjmp top            2
+//      (delayLow)
+//      out  USICR,data     1   SCL released at the end of this cycle
+//      = 4 cycles plus the delay. Where USISR is outside the I/O space
+//      (e.g. ATmega169) it is lds/sbrs which is longer.
+//
+// High: from SCL being seen high
+//      sbis PIN_USI,SCL    2   skips the call to i2cTimedOut()
+//      (delayHigh)
+//      out  USICR,data     1   negative SCL edge
+//      = 3 cycles plus the delay. The rise time and any i2cTimedOut()
+//      calls while waiting for SCL only lengthen the high period.
+//
+// e.g. at 16MHz fast mode low is 21 cycles (1.31us) against 1.3us and
+// high 20 cycles (1.25us) against 0.6us.
+#define TWI_LOOP_LOW    4
+#define TWI_LOOP_HIGH   3
+
+#define TWI_DELAY(cycles, loop) (__builtin_avr_delay_cycles( ((cycles) > (loop)) ? ((cycles) - (loop)) : 0 ))
+
+#define DELAY_STD_LOW   TWI_DELAY(TWI_STD_LOW, TWI_LOOP_LOW)
+#define DELAY_STD_HIGH  TWI_DELAY(TWI_STD_HIGH, TWI_LOOP_HIGH)
+#define DELAY_FAST_LOW  TWI_DELAY(TWI_FAST_LOW, TWI_LOOP_LOW)
+#define DELAY_FAST_HIGH TWI_DELAY(TWI_FAST_HIGH, TWI_LOOP_HIGH)
+
+// Delays for the start and stop conditions
+#define DELAY_T2TWI (bUSIFast ? TWI_DELAY(TWI_FAST_LOW, 0) : TWI_DELAY(TWI_STD_LOW, 0))
+#define DELAY_T4TWI (bUSIFast ? TWI_DELAY(TWI_FAST_HIGH, 0) : TWI_DELAY(TWI_STD_HIGH, 0))
 
 /****************************************************************************
   Bit and byte definitions
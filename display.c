@@ -5,8 +5,11 @@
  * Author : Richard Tomlinson G4TGJ
  */ 
 
+#ifdef __AVR__
 #include <avr/io.h>
+#endif
 
+#include <inttypes.h>
 #include <string.h>
 #include <stdio.h>
 
@@ -17,14 +20,26 @@
 // Keep track of the cursor position
 static uint8_t cursorCol, cursorLine;
 
-#ifndef DISPLAY_DISABLE_SCROLLING
+#if !defined DISPLAY_DISABLE_SCROLLING || defined DISPLAY_DEFERRED
 // Keep track of each line
 static char textBuf[LCD_HEIGHT][ LCD_WIDTH + 1];
+#endif
 
+#ifndef DISPLAY_DISABLE_SCROLLING
 // Split point for the line
 static uint8_t splitPoint[LCD_HEIGHT];
 #endif
 
+#ifdef DISPLAY_DEFERRED
+// Maximum number of characters written by each call to displayUpdate()
+#ifndef DISPLAY_UPDATE_CHARS
+#define DISPLAY_UPDATE_CHARS LCD_WIDTH
+#endif
+
+// What is currently shown on each line of the LCD
+static char shownBuf[LCD_HEIGHT][LCD_WIDTH];
+#endif
+
 // Update the line buffer
 // Text scrolls in from the right unless bReplace is true
 // in which case the new text replaces the existing line
@@ -87,15 +102,71 @@ void displayText( uint8_t line, char *text, bool bReplace )
             }
         }
 #endif
+#ifdef DISPLAY_DEFERRED
+#ifdef DISPLAY_DISABLE_SCROLLING
+        // Overwrite the start of the line leaving the rest as it is
+        for( int i = 0 ; (i < LCD_WIDTH) && pBuf[i] ; i++ )
+        {
+            textBuf[line][i] = pBuf[i];
+        }
+#endif
+        // The LCD is written later by displayUpdate()
+#else
         // Move to the start of the line and print the buffer
         lcdSetCursor( 0, line );
         lcdPrint( pBuf );
         
         // Put the cursor back to where it was
         lcdSetCursor( cursorCol, cursorLine );
+#endif
     }
 }
 
+#ifdef DISPLAY_DEFERRED
+// Write the next changed part of the display to the LCD
+// Returns true if anything was written
+bool displayUpdate( void )
+{
+    // The text to write
+    char text[DISPLAY_UPDATE_CHARS + 1];
+    uint8_t first, last, i;
+
+    for( uint8_t line = 0 ; line < LCD_HEIGHT ; line++ )
+    {
+        // Find the first changed character on the line
+        for( first = 0 ; (first < LCD_WIDTH) && (textBuf[line][first] == shownBuf[line][first]) ; first++ );
+
+        if( first < LCD_WIDTH )
+        {
+            // Find the last changed character and limit the
+            // number to write this time
+            for( last = LCD_WIDTH - 1 ; textBuf[line][last] == shownBuf[line][last] ; last-- );
+            if( (last - first) >= DISPLAY_UPDATE_CHARS )
+            {
+                last = first + DISPLAY_UPDATE_CHARS - 1;
+            }
+
+            for( i = first ; i <= last ; i++ )
+            {
+                text[i - first] = textBuf[line][i];
+                shownBuf[line][i] = textBuf[line][i];
+            }
+            text[i - first] = '\0';
+
+            lcdSetCursor( first, line );
+            lcdPrint( text );
+
+            // Put the cursor back to where it was
+            lcdSetCursor( cursorCol, cursorLine );
+
+            return true;
+        }
+    }
+
+    return false;
+}
+#endif
+
 void displayInit()
 {
     lcdInit();
@@ -107,7 +178,7 @@ void displayInit()
     lcdAutoscrollOff();
     displayCursor(0, 0, cursorOff);
 
-#ifndef DISPLAY_DISABLE_SCROLLING
+#if !defined DISPLAY_DISABLE_SCROLLING || defined DISPLAY_DEFERRED
     // Initialise all line buffers with spaces
     for( int line = 0 ; line < LCD_HEIGHT ; line++ )
     {
@@ -115,6 +186,14 @@ void displayInit()
         textBuf[line][LCD_WIDTH] = '\0';
     }
 #endif
+
+#ifdef DISPLAY_DEFERRED
+    // The LCD has been cleared
+    for( int line = 0 ; line < LCD_HEIGHT ; line++ )
+    {
+        memset( shownBuf[line], ' ', LCD_WIDTH );
+    }
+#endif
 }
     
 // Set the cursor position and state (off, underline or blink)
@@ -21,12 +21,28 @@ void displayInit();
 /// Display text on the specified line replacing the existing text
 /// or scrolling from the right.
 ///
+/// If DISPLAY_DEFERRED is defined the text is only stored and
+/// displayUpdate() writes it to the LCD.
+///
 /// @param[in] line Line number
 /// @param[in] text Pointer to the text to display
 /// @param[in] bReplace If true then replace the existing line,
 ///                     otherwise scroll the text in
 void displayText( uint8_t line, char *text, bool bReplace );
 
+/// Write the next changed part of the display to the LCD.
+///
+/// Only available when DISPLAY_DEFERRED is defined. Only the characters
+/// that have changed are written so several calls to displayText()
+/// between updates cost no more than one. Each call writes part of
+/// one line, at most DISPLAY_UPDATE_CHARS characters, so calling this
+/// once each time round the main loop keeps the delay to other work,
+/// such as tuning the oscillator, short.
+///
+/// @returns true if anything was written
+/// @returns false if the LCD is up to date
+bool displayUpdate( void );
+
 /// Set the cursor position and state (off, underline or blink).
 ///
 /// @param[in] col Column number
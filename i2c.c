@@ -3,15 +3,154 @@
  *
  * I2C driver supporting most AVR hardware.
  *
+ * The hardware specific backend is included below. Each backend
+ * provides i2cInit(), the blocking block transfer functions
+ * i2cWriteBlock() and i2cReadBlock(), where a null register address
+ * pointer to i2cWriteBlock() sends the data alone, and i2cClockSetting() and
+ * i2cApplyClockSetting() to set the bus clock, and i2cDisable()
+ * and i2cEnable() to hand the pins over to GPIO for bus recovery.
+ * Wait loops in the backend must end when i2cTimedOut() returns true.
+ * If the pins are known the backend also defines the I2C_SCL_xxx and
+ * I2C_SDA_xxx macros used by the recovery sequence. Backends that can be driven
+ * by interrupt define I2C_INTERRUPT_DRIVEN and provide
+ * i2cTransferStart(), i2cPoll() and the ISR which calls
+ * i2cTransferComplete() when the transaction has finished.
+ *
+ * When not compiled for an AVR the simulated backend in i2c_sim.c
+ * is used so that the code using I2C can be run and tested on a host.
+ *
  * Created: 04/09/2020 20:51:19
  *  Author: Richard Tomlinson
- */ 
+ */
 
+ #ifdef __AVR__
  #include <avr/io.h>
+ #include <util/atomic.h>
+ #endif
+
+ #include "config.h"
+ #include "i2c.h"
+ #include "millis.h"
+
+ #ifdef I2C_STATS
+ #include <stdio.h>
+ #include "serial.h"
+ #endif
+
+ // Default bus clock rate
+ #ifndef I2C_CLOCK_RATE
+ #define I2C_CLOCK_RATE 400000
+ #endif
+
+ // Number of devices that can have their own clock rate
+ #ifndef I2C_NUM_DEVICE_CLOCKS
+ #define I2C_NUM_DEVICE_CLOCKS 4
+ #endif
+
+ // Time allowed for a transaction: a fixed time plus a time per
+ // byte which allows for clock rates down to about 50kHz
+ #ifndef I2C_TIMEOUT_US
+ #define I2C_TIMEOUT_US 1000
+ #endif
+ #ifndef I2C_TIMEOUT_BYTE_US
+ #define I2C_TIMEOUT_BYTE_US 200
+ #endif
+
+ // Fewest CPU cycles each check of the timeout can take. A check
+ // includes a call to micros() which takes well over this so the
+ // limit on the number of checks, used in case micros() isn't
+ // advancing, is never reached before the deadline.
+ #ifndef I2C_TIMEOUT_CHECK_CYCLES
+ #define I2C_TIMEOUT_CHECK_CYCLES 32
+ #endif
+
+ // Half a clock period for the bus recovery sequence (100kHz)
+ #define I2C_RECOVERY_HALF_US 5
+
+ // Number of transactions that can be waiting for the bus
+ #ifndef I2C_QUEUE_LEN
+ #define I2C_QUEUE_LEN 4
+ #endif
+
+ // Longest run of unchanged registers that a cached write sends
+ // rather than splitting into two transactions
+ #ifndef I2C_CACHE_RUN_GAP
+ #define I2C_CACHE_RUN_GAP 2
+ #endif
+
+ // Number of devices that can have their own priority
+ #ifndef I2C_NUM_DEVICE_PRIORITIES
+ #define I2C_NUM_DEVICE_PRIORITIES 2
+ #endif
+
+ // Number of devices with counters and number of transactions traced
+ #ifndef I2C_STATS_DEVICES
+ #define I2C_STATS_DEVICES 4
+ #endif
+ #ifndef I2C_TRACE_LEN
+ #define I2C_TRACE_LEN 8
+ #endif
+
+ #ifdef I2C_ASYNC
+ static void i2cTransferComplete( uint8_t error );
+ #endif
+
+ static void i2cSelectClock( uint8_t addr );
+
+// When the current transaction must finish by and how many more
+// times the timeout can be checked before giving up anyway
+static uint32_t i2cDeadline;
+static uint32_t i2cChecksLeft;
+
+// Set when the current transaction has run out of time
+static volatile bool bI2CTimeout;
+
+#ifdef I2C_STATS
+// When the current transaction started and how many times it has
+// been round a wait loop
+static uint32_t i2cStartTime;
+static uint32_t i2cWaits;
+#endif
+
+// Start timing a transaction of len bytes
+static void i2cStartTimeout( uint8_t len )
+{
+    uint32_t now = micros();
+    uint32_t timeout = I2C_TIMEOUT_US + (uint32_t) len * I2C_TIMEOUT_BYTE_US;
+
+    bI2CTimeout = false;
+    i2cDeadline = now + timeout;
+    i2cChecksLeft = timeout * (F_CPU / 1000000) / I2C_TIMEOUT_CHECK_CYCLES;
+
+#ifdef I2C_STATS
+    i2cStartTime = now;
+    i2cWaits = 0;
+#endif
+}
+
+// Returns true once the current transaction has run out of time.
+// If the millisecond timer isn't running, or interrupts are disabled
+// for more than a millisecond, micros() doesn't reach the deadline so
+// the number of checks is limited too.
+static bool i2cTimedOut( void )
+{
+#ifdef I2C_STATS
+    i2cWaits++;
+#endif
+
+    if( !bI2CTimeout && ((i2cChecksLeft-- == 0) || ((int32_t)(micros() - i2cDeadline) >= 0)) )
+    {
+        bI2CTimeout = true;
+    }
+
+    return bI2CTimeout;
+}
 
  // Select the correct I2C driver
 
- #if defined TWI0
+ #if !defined __AVR__
+ #include "i2c_sim.c"
+ #elif defined TWI0
  #include "i2c_tiny.c"
  #elif defined TWCR
  #include "i2c_mega.c"
@@ -19,4 +158,751 @@
  #include "USI_TWI_Master.c"
  #else
  #error "No support for I2C"
- #endif
\ No newline at end of file
+ #endif
+
+// Recover the bus after a timeout.
+// A slave may be holding SDA low part way through a byte so clock it
+// up to 9 times until it lets go and then send a stop.
+// Returns the error code for the timeout.
+static uint8_t i2cRecover( void )
+{
+    uint8_t result = I2C_ERROR_TIMEOUT;
+
+    // Take the pins away from the TWI or USI
+    i2cDisable();
+
+#ifdef I2C_SCL_LOW
+    delayMicroseconds( I2C_RECOVERY_HALF_US );
+
+    // If SCL is held low there is nothing we can do
+    if( !I2C_SCL_HIGH() )
+    {
+        result = I2C_ERROR_SCL_STUCK;
+    }
+    else
+    {
+        for( uint8_t i = 0 ; (i < 9) && !I2C_SDA_HIGH() ; i++ )
+        {
+            I2C_SCL_LOW();
+            delayMicroseconds( I2C_RECOVERY_HALF_US );
+            I2C_SCL_RELEASE();
+            delayMicroseconds( I2C_RECOVERY_HALF_US );
+        }
+
+        // Stop condition - SDA rises while SCL is high
+        I2C_SCL_LOW();
+        delayMicroseconds( I2C_RECOVERY_HALF_US );
+        I2C_SDA_LOW();
+        delayMicroseconds( I2C_RECOVERY_HALF_US );
+        I2C_SCL_RELEASE();
+        delayMicroseconds( I2C_RECOVERY_HALF_US );
+        I2C_SDA_RELEASE();
+        delayMicroseconds( I2C_RECOVERY_HALF_US );
+
+        if( !I2C_SDA_HIGH() )
+        {
+            result = I2C_ERROR_SDA_STUCK;
+        }
+    }
+#endif
+
+    // Give the pins back
+    i2cEnable();
+
+    return result;
+}
+
+#ifdef I2C_STATS
+
+// Counters for each device
+static struct sI2CStats i2cStats[I2C_STATS_DEVICES];
+static uint8_t numI2CStats;
+
+// The most recent transactions
+// posTrace is where the next one will be recorded
+static struct sI2CTrace i2cTrace[I2C_TRACE_LEN];
+static uint8_t posTrace, numTrace;
+
+// Update the counters and trace at the end of a transaction
+static void i2cStatsRecord( uint8_t addr, uint8_t reg, uint8_t len, uint8_t result )
+{
+    uint32_t duration = micros() - i2cStartTime;
+    struct sI2CStats *pStats = 0;
+    struct sI2CTrace *pTrace;
+    uint8_t i;
+
+    for( i = 0 ; i < numI2CStats ; i++ )
+    {
+        if( i2cStats[i].addr == addr )
+        {
+            pStats = &i2cStats[i];
+            break;
+        }
+    }
+
+    // Start counting for a new device if there is room
+    if( (pStats == 0) && (numI2CStats < I2C_STATS_DEVICES) )
+    {
+        pStats = &i2cStats[numI2CStats++];
+        pStats->addr = addr;
+    }
+
+    if( pStats )
+    {
+        pStats->transactions++;
+        pStats->bytes += len;
+        pStats->waits += i2cWaits;
+        if( result >= I2C_ERROR_TIMEOUT )
+        {
+            pStats->timeouts++;
+        }
+        else if( result > 1 )
+        {
+            // Steps 2 to 6 fail when a byte is not acknowledged
+            pStats->nacks++;
+        }
+    }
+
+    pTrace = &i2cTrace[posTrace];
+    pTrace->time = i2cStartTime;
+    pTrace->duration = (duration > 0xFFFF) ? 0xFFFF : duration;
+    pTrace->addr = addr;
+    pTrace->reg = reg;
+    pTrace->len = len;
+    pTrace->status = result;
+
+    posTrace = (posTrace + 1) % I2C_TRACE_LEN;
+    if( numTrace < I2C_TRACE_LEN )
+    {
+        numTrace++;
+    }
+}
+
+const struct sI2CStats *i2cGetStats( uint8_t addr )
+{
+    for( uint8_t i = 0 ; i < numI2CStats ; i++ )
+    {
+        if( i2cStats[i].addr == addr )
+        {
+            return &i2cStats[i];
+        }
+    }
+
+    return 0;
+}
+
+void i2cResetStats( void )
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        numI2CStats = 0;
+        posTrace = 0;
+        numTrace = 0;
+    }
+}
+
+bool i2cDumpStats( uint8_t line )
+{
+    char text[48];
+    struct sI2CStats stats;
+    struct sI2CTrace trace;
+
+    // Take a copy as the counters may be updated by the interrupt
+    if( line < numI2CStats )
+    {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            stats = i2cStats[line];
+        }
+        sprintf( text, "I2C %02X T%u B%" PRIu32 " N%u O%u W%" PRIu32 "\r\n", stats.addr, stats.transactions,
+                 stats.bytes, stats.nacks, stats.timeouts, stats.waits );
+    }
+    else if( (uint8_t)(line - numI2CStats) < numTrace )
+    {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            trace = i2cTrace[(posTrace + I2C_TRACE_LEN - numTrace + line - numI2CStats) % I2C_TRACE_LEN];
+        }
+        sprintf( text, "@%" PRIu32 " %02X R%02X L%u S%02X D%u\r\n", trace.time, trace.addr,
+                 trace.reg, trace.len, trace.status, trace.duration );
+    }
+    else
+    {
+        return false;
+    }
+
+    serialTXString( text );
+
+    return true;
+}
+
+#else
+#define i2cStatsRecord( addr, reg, len, result )
+#endif
+
+// Devices that have their own priority
+static struct
+{
+    uint8_t addr;
+    uint8_t priority;
+} i2cDevicePriorities[I2C_NUM_DEVICE_PRIORITIES];
+static uint8_t numDevicePriorities;
+
+bool i2cSetDevicePriority( uint8_t addr, enum eI2CPriority priority )
+{
+    uint8_t i;
+
+    // Replace any existing setting for the device
+    for( i = 0 ; i < numDevicePriorities ; i++ )
+    {
+        if( i2cDevicePriorities[i].addr == addr )
+        {
+            break;
+        }
+    }
+
+    if( i == I2C_NUM_DEVICE_PRIORITIES )
+    {
+        return false;
+    }
+    else if( i == numDevicePriorities )
+    {
+        numDevicePriorities++;
+    }
+
+    i2cDevicePriorities[i].addr = addr;
+    i2cDevicePriorities[i].priority = priority;
+
+    return true;
+}
+
+#ifdef I2C_ASYNC
+
+// Get the priority for a device's transactions
+static enum eI2CPriority i2cDevicePriority( uint8_t addr )
+{
+    for( uint8_t i = 0 ; i < numDevicePriorities ; i++ )
+    {
+        if( i2cDevicePriorities[i].addr == addr )
+        {
+            return i2cDevicePriorities[i].priority;
+        }
+    }
+
+    return I2C_PRIORITY_HIGH;
+}
+
+// Transactions waiting for the bus with a queue for each priority
+static struct sI2CTransaction * volatile i2cQueueBuf[I2C_NUM_PRIORITIES][I2C_QUEUE_LEN];
+
+// Current write and read positions in each queue
+// A queue is empty when they are the same
+static volatile uint8_t posQueueWrite[I2C_NUM_PRIORITIES], posQueueRead[I2C_NUM_PRIORITIES];
+
+// The transaction currently on the bus or null if idle
+static struct sI2CTransaction * volatile pActive;
+
+#ifndef I2C_INTERRUPT_DRIVEN
+// No interrupt support so perform the transaction now
+static void i2cTransferStart( struct sI2CTransaction *pTrans )
+{
+    uint8_t error;
+
+    if( pTrans->bRead )
+    {
+        error = i2cReadBlock( pTrans->addr, pTrans->reg, pTrans->buf, pTrans->len );
+    }
+    else
+    {
+        error = i2cWriteBlock( pTrans->addr, pTrans->bNoReg ? 0 : &pTrans->reg, pTrans->buf, pTrans->len );
+    }
+
+    if( bI2CTimeout )
+    {
+        error = i2cRecover();
+    }
+    i2cTransferComplete( error );
+}
+
+static void i2cPoll()
+{
+}
+#endif
+
+// Start the transaction that has just become active
+static void i2cStartActive( struct sI2CTransaction *pTrans )
+{
+    i2cStartTimeout( pTrans->len );
+    i2cSelectClock( pTrans->addr );
+    i2cTransferStart( pTrans );
+}
+
+// Called by the backend when the active transaction has finished
+// and after a timeout, when interrupts may be enabled.
+// Starts the next queued transaction and then calls the completed
+// transaction's callback.
+static void i2cTransferComplete( uint8_t error )
+{
+    struct sI2CTransaction *pDone = pActive;
+    struct sI2CTransaction *pNext = 0;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        i2cStatsRecord( pDone->addr, pDone->reg, pDone->len, error );
+
+        pDone->error = error;
+        pDone->status = error ? I2C_STATUS_ERROR : I2C_STATUS_DONE;
+
+        // Keep the bus busy by starting the next transaction straight away
+        // taking it from the highest priority queue
+        for( uint8_t p = 0 ; p < I2C_NUM_PRIORITIES ; p++ )
+        {
+            if( posQueueRead[p] != posQueueWrite[p] )
+            {
+                pNext = i2cQueueBuf[p][posQueueRead[p]];
+                posQueueRead[p] = (posQueueRead[p] + 1) % I2C_QUEUE_LEN;
+                pNext->status = I2C_STATUS_ACTIVE;
+                break;
+            }
+        }
+        pActive = pNext;
+    }
+
+    if( pNext )
+    {
+        i2cStartActive( pNext );
+    }
+
+    if( pDone->callback )
+    {
+        pDone->callback( pDone );
+    }
+}
+
+bool i2cQueue( struct sI2CTransaction *pTrans )
+{
+    bool bQueued = true;
+    bool bStart = false;
+    uint8_t p = pTrans->priority;
+
+    if( p >= I2C_NUM_PRIORITIES )
+    {
+        p = I2C_PRIORITY_LOW;
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if( pActive == 0 )
+        {
+            // Bus is idle so start this one now
+            pActive = pTrans;
+            pTrans->status = I2C_STATUS_ACTIVE;
+            bStart = true;
+        }
+        else if( ((posQueueWrite[p] + 1) % I2C_QUEUE_LEN) == posQueueRead[p] )
+        {
+            // Queue is full
+            bQueued = false;
+        }
+        else
+        {
+            pTrans->status = I2C_STATUS_QUEUED;
+            i2cQueueBuf[p][posQueueWrite[p]] = pTrans;
+            posQueueWrite[p] = (posQueueWrite[p] + 1) % I2C_QUEUE_LEN;
+        }
+    }
+
+    // Start outside the atomic block as a backend without interrupt
+    // support completes the whole transaction here
+    if( bStart )
+    {
+        i2cStartActive( pTrans );
+    }
+
+    return bQueued;
+}
+
+// Abandon the active transaction if it has run out of time
+// and recover the bus.
+// Only the check and disabling the TWI, which stops its interrupt
+// touching the transaction, need interrupts off. The recovery takes
+// around 100us so is done with them on.
+static void i2cCheckTimeout( void )
+{
+    bool bRecover = false;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if( pActive && i2cTimedOut() )
+        {
+            i2cDisable();
+            bRecover = true;
+        }
+    }
+
+    if( bRecover )
+    {
+        i2cTransferComplete( i2cRecover() );
+    }
+}
+
+uint8_t i2cWait( struct sI2CTransaction *pTrans )
+{
+    while( (pTrans->status == I2C_STATUS_QUEUED) || (pTrans->status == I2C_STATUS_ACTIVE) )
+    {
+        // Drive the transaction if interrupts are disabled
+        i2cPoll();
+        i2cCheckTimeout();
+    }
+
+    return pTrans->error;
+}
+
+bool i2cBusy( void )
+{
+    i2cCheckTimeout();
+
+    return pActive != 0;
+}
+
+// Perform a transaction through the queue and wait for it to complete
+// A write with a null register address pointer sends the data alone
+static uint8_t i2cTransferWait( uint8_t addr, const uint8_t *pReg, uint8_t *buf, uint8_t len, bool bRead )
+{
+    struct sI2CTransaction trans;
+
+    trans.addr = addr;
+    trans.reg = pReg ? *pReg : 0;
+    trans.buf = buf;
+    trans.len = len;
+    trans.bRead = bRead;
+    trans.bNoReg = (pReg == 0);
+    trans.priority = i2cDevicePriority( addr );
+    trans.status = I2C_STATUS_IDLE;
+    trans.error = 0;
+    trans.callback = 0;
+
+    // Wait for space in the queue
+    while( !i2cQueue( &trans ) )
+    {
+        i2cPoll();
+        i2cCheckTimeout();
+    }
+
+    return i2cWait( &trans );
+}
+
+#endif
+
+// Clock rates for devices with their own rate
+static struct
+{
+    uint8_t  addr;
+    uint16_t setting;
+} i2cDeviceClock[I2C_NUM_DEVICE_CLOCKS];
+static uint8_t numDeviceClocks;
+
+// The setting for all other devices and the setting currently in use
+static uint16_t i2cDefaultSetting, i2cCurrentSetting;
+
+void i2cSetClock( uint32_t hz )
+{
+    i2cStartTimeout( 0 );
+    i2cDefaultSetting = i2cClockSetting( hz );
+    i2cCurrentSetting = i2cDefaultSetting;
+    i2cApplyClockSetting( i2cCurrentSetting );
+}
+
+bool i2cSetDeviceClock( uint8_t addr, uint32_t hz )
+{
+    uint8_t i;
+
+    // Replace any existing setting for the device
+    for( i = 0 ; i < numDeviceClocks ; i++ )
+    {
+        if( i2cDeviceClock[i].addr == addr )
+        {
+            break;
+        }
+    }
+
+    if( i == I2C_NUM_DEVICE_CLOCKS )
+    {
+        return false;
+    }
+    else if( i == numDeviceClocks )
+    {
+        numDeviceClocks++;
+    }
+
+    i2cDeviceClock[i].addr = addr;
+    i2cDeviceClock[i].setting = i2cClockSetting( hz );
+
+    return true;
+}
+
+// Switch to the device's clock rate if it isn't already in use
+static void i2cSelectClock( uint8_t addr )
+{
+    uint16_t setting = i2cDefaultSetting;
+
+    for( uint8_t i = 0 ; i < numDeviceClocks ; i++ )
+    {
+        if( i2cDeviceClock[i].addr == addr )
+        {
+            setting = i2cDeviceClock[i].setting;
+            break;
+        }
+    }
+
+    if( setting != i2cCurrentSetting )
+    {
+        i2cCurrentSetting = setting;
+        i2cApplyClockSetting( setting );
+    }
+}
+
+// Write with the register address if pReg is not null
+static uint8_t i2cWriteTransfer( uint8_t addr, const uint8_t *pReg, const uint8_t *buf, uint8_t len )
+{
+#ifdef I2C_ASYNC
+    return i2cTransferWait( addr, pReg, (uint8_t *) buf, len, false );
+#else
+    uint8_t result;
+
+    i2cStartTimeout( len );
+    i2cSelectClock( addr );
+    result = i2cWriteBlock( addr, pReg, buf, len );
+
+    if( bI2CTimeout )
+    {
+        result = i2cRecover();
+    }
+    i2cStatsRecord( addr, pReg ? *pReg : 0, len, result );
+
+    return result;
+#endif
+}
+
+uint8_t i2cWrite( uint8_t addr, const uint8_t *buf, uint8_t len )
+{
+    return i2cWriteTransfer( addr, 0, buf, len );
+}
+
+uint8_t i2cWriteRegisters(uint8_t addr, uint8_t startReg, const uint8_t *buf, uint8_t len)
+{
+    return i2cWriteTransfer( addr, &startReg, buf, len );
+}
+
+uint8_t i2cWriteRegister(uint8_t addr, uint8_t reg, uint8_t data)
+{
+    return i2cWriteRegisters( addr, reg, &data, 1 );
+}
+
+uint8_t i2cReadRegisters(uint8_t addr, uint8_t startReg, uint8_t *buf, uint8_t len)
+{
+    if( len == 0 ) return 0;
+
+#ifdef I2C_ASYNC
+    return i2cTransferWait( addr, &startReg, buf, len, true );
+#else
+    uint8_t result;
+
+    i2cStartTimeout( len );
+    i2cSelectClock( addr );
+    result = i2cReadBlock( addr, startReg, buf, len );
+
+    if( bI2CTimeout )
+    {
+        result = i2cRecover();
+    }
+    i2cStatsRecord( addr, startReg, len, result );
+
+    return result;
+#endif
+}
+
+uint8_t i2cReadRegister(uint8_t addr, uint8_t reg, uint8_t *data)
+{
+    return i2cReadRegisters( addr, reg, data, 1 );
+}
+
+// Linked list of register caches
+static struct sI2CCache *pCacheList;
+
+void i2cCacheAdd( struct sI2CCache *pCache )
+{
+    struct sI2CCache *p;
+
+    // Check it hasn't already been added
+    for( p = pCacheList ; p ; p = p->pNext )
+    {
+        if( p == pCache )
+        {
+            return;
+        }
+    }
+
+    for( uint8_t i = 0 ; i < I2C_CACHE_VALID_LEN(pCache->numRegs) ; i++ )
+    {
+        pCache->valid[i] = 0;
+    }
+
+    pCache->pNext = pCacheList;
+    pCacheList = pCache;
+}
+
+// Find the cache holding a register or null if not cached
+static struct sI2CCache *i2cCacheFind( uint8_t addr, uint8_t reg )
+{
+    struct sI2CCache *p;
+
+    for( p = pCacheList ; p ; p = p->pNext )
+    {
+        if( (p->addr == addr) && (reg >= p->firstReg) && ((uint8_t)(reg - p->firstReg) < p->numRegs) )
+        {
+            break;
+        }
+    }
+
+    return p;
+}
+
+// Returns true if the register is known to hold the value
+static bool i2cCacheMatches( uint8_t addr, uint8_t reg, uint8_t data )
+{
+    struct sI2CCache *p = i2cCacheFind( addr, reg );
+
+    if( p )
+    {
+        uint8_t i = reg - p->firstReg;
+
+        return (p->valid[i/8] & (1 << (i%8))) && (p->regs[i] == data);
+    }
+
+    return false;
+}
+
+// Record the register value or mark it as unknown
+static void i2cCacheStore( uint8_t addr, uint8_t reg, uint8_t data, bool bValid )
+{
+    struct sI2CCache *p = i2cCacheFind( addr, reg );
+
+    if( p )
+    {
+        uint8_t i = reg - p->firstReg;
+
+        p->regs[i] = data;
+        if( bValid )
+        {
+            p->valid[i/8] |= (1 << (i%8));
+        }
+        else
+        {
+            p->valid[i/8] &= ~(1 << (i%8));
+        }
+    }
+}
+
+uint8_t i2cCacheWriteRegisters(uint8_t addr, uint8_t startReg, const uint8_t *buf, uint8_t len)
+{
+    uint8_t result = 0;
+    uint8_t first, last, i, r;
+
+    for( first = 0 ; first < len ; first = last + 1 )
+    {
+        // Find the start of the next run of changed registers
+        while( (first < len) && i2cCacheMatches( addr, startReg + first, buf[first] ) )
+        {
+            first++;
+        }
+
+        if( first == len )
+        {
+            break;
+        }
+
+        // Extend the run over short gaps of unchanged registers as
+        // resending them is cheaper than starting a new transaction
+        last = first;
+        for( i = first + 1 ; (i < len) && (i <= last + I2C_CACHE_RUN_GAP + 1) ; i++ )
+        {
+            if( !i2cCacheMatches( addr, startReg + i, buf[i] ) )
+            {
+                last = i;
+            }
+        }
+
+        struct sI2CCache *p = i2cCacheFind( addr, startReg + first );
+
+        if( p && p->bRegisterless )
+        {
+            // No register address so send the data alone
+            r = i2cWrite( addr, &buf[first], 1 );
+            last = first;
+        }
+        else
+        {
+            r = i2cWriteRegisters( addr, startReg + first, &buf[first], last - first + 1 );
+        }
+
+        // If the write failed we no longer know what the registers hold
+        for( i = first ; i <= last ; i++ )
+        {
+            i2cCacheStore( addr, startReg + i, buf[i], r == 0 );
+        }
+
+        if( r != 0 )
+        {
+            result = r;
+        }
+    }
+
+    return result;
+}
+
+uint8_t i2cCacheWriteRegister(uint8_t addr, uint8_t reg, uint8_t data)
+{
+    return i2cCacheWriteRegisters( addr, reg, &data, 1 );
+}
+
+uint8_t i2cCacheReadRegister(uint8_t addr, uint8_t reg, uint8_t *data)
+{
+    uint8_t result = 0;
+    struct sI2CCache *p = i2cCacheFind( addr, reg );
+
+    uint8_t i = p ? (reg - p->firstReg) : 0;
+
+    if( p && (p->valid[i/8] & (1 << (i%8))) )
+    {
+        *data = p->regs[i];
+    }
+    else
+    {
+        result = i2cReadRegister( addr, reg, data );
+        i2cCacheStore( addr, reg, *data, result == 0 );
+    }
+
+    return result;
+}
+
+void i2cCacheInvalidate( uint8_t addr )
+{
+    struct sI2CCache *p;
+
+    for( p = pCacheList ; p ; p = p->pNext )
+    {
+        if( p->addr == addr )
+        {
+            for( uint8_t i = 0 ; i < I2C_CACHE_VALID_LEN(p->numRegs) ; i++ )
+            {
+                p->valid[i] = 0;
+            }
+        }
+    }
+}
+
+void i2cCacheInvalidateRegister( uint8_t addr, uint8_t reg )
+{
+    i2cCacheStore( addr, reg, 0, false );
+}
@@ -1,4 +1,4 @@
-/** \file cat.h
+/** \file i2c.h
  *
  * \author Richard Tomlinson G4TGJ
  */ 
@@ -8,12 +8,51 @@
 #define I2C_H
 
 #include <inttypes.h>
+#include <stdbool.h>
+
+/// @name Error codes
+/// The transfer functions return 0 on success, 1 to 6 for the step of
+/// the transaction that failed (e.g. the address or data not being
+/// acknowledged) or one of the following if the transaction timed out.
+///
+/// A timed out transaction is followed by a bus recovery sequence:
+/// up to 9 clocks are sent until the slave releases SDA and then a stop.
+/// Timeouts are measured with micros() so need millisInit() to have
+/// been called and interrupts enabled. Without them the number of
+/// wait loops is limited instead, assuming each takes at least
+/// I2C_TIMEOUT_CHECK_CYCLES (default 32) CPU cycles, so a transaction
+/// still ends but after a time that depends on the backend.
+/// @{
+#define I2C_ERROR_TIMEOUT       0x10    ///< Timed out but the bus has been recovered
+#define I2C_ERROR_SCL_STUCK     0x11    ///< Timed out and SCL is held low
+#define I2C_ERROR_SDA_STUCK     0x12    ///< Timed out and SDA is still held low after recovery
+/// @}
 
 /// Initialise the I2C driver.
 ///
 /// Must be called before any other I2C functions.
 void i2cInit();
 
+/// Set the I2C bus clock rate.
+///
+/// This is the rate used for all devices that have not had their own
+/// rate set. The nearest rate that does not exceed the requested rate
+/// is used. Rates above 400kHz enable Fast-mode Plus where the
+/// hardware supports it.
+///
+/// @param[in] hz Clock rate in hertz
+void i2cSetClock( uint32_t hz );
+
+/// Set the preferred clock rate for a device.
+///
+/// The rate is switched in for each transaction with the device.
+///
+/// @param[in] addr I2C address
+/// @param[in] hz Clock rate in hertz
+/// @returns true if successful
+/// @returns false if too many devices have their own rate
+bool i2cSetDeviceClock( uint8_t addr, uint32_t hz );
+
 /// Write to an 8 bit register over I2C.
 ///
 /// @param[in] addr I2C address
@@ -21,6 +60,25 @@ void i2cInit();
 /// @param[in] data Data to write to register
 uint8_t i2cWriteRegister(uint8_t addr, uint8_t reg, uint8_t data);
 
+/// Write to a block of consecutive 8 bit registers over I2C.
+///
+/// All the registers are sent in a single transaction relying on
+/// the device auto-incrementing the register address.
+///
+/// @param[in] addr I2C address
+/// @param[in] startReg Address of the first register
+/// @param[in] buf Pointer to the data to write
+/// @param[in] len Number of registers to write
+uint8_t i2cWriteRegisters(uint8_t addr, uint8_t startReg, const uint8_t *buf, uint8_t len);
+
+/// Write bytes to a device that has no register address
+/// e.g. a port expander.
+///
+/// @param[in] addr I2C address
+/// @param[in] buf Pointer to the data to write
+/// @param[in] len Number of bytes to write
+uint8_t i2cWrite( uint8_t addr, const uint8_t *buf, uint8_t len );
+
 /// Read from an 8 bit register over I2C.
 ///
 /// @param[in] addr I2C address
@@ -28,4 +86,213 @@ uint8_t i2cWriteRegister(uint8_t addr, uint8_t reg, uint8_t data);
 /// @param[out] data Pointer to data location to write contents of register to
 uint8_t i2cReadRegister(uint8_t addr, uint8_t reg, uint8_t *data);
 
+/// Read from a block of consecutive 8 bit registers over I2C.
+///
+/// All the registers are read in a single transaction relying on
+/// the device auto-incrementing the register address. Every byte
+/// is ACKed except the last which is NACKed to end the transfer.
+///
+/// @param[in] addr I2C address
+/// @param[in] startReg Address of the first register
+/// @param[out] buf Pointer to buffer to receive the register contents
+/// @param[in] len Number of registers to read
+uint8_t i2cReadRegisters(uint8_t addr, uint8_t startReg, uint8_t *buf, uint8_t len);
+
+/// State of a queued I2C transaction.
+enum eI2CStatus
+{
+    I2C_STATUS_IDLE,    ///< Not yet queued
+    I2C_STATUS_QUEUED,  ///< Waiting in the queue for the bus
+    I2C_STATUS_ACTIVE,  ///< Currently on the bus
+    I2C_STATUS_DONE,    ///< Completed successfully
+    I2C_STATUS_ERROR    ///< Failed - the error field holds the reason
+};
+
+/// Priority of a transaction.
+///
+/// When the bus becomes free the next transaction is taken from the
+/// highest priority queue that has one waiting. A transaction on the
+/// bus is always allowed to finish so a high priority transaction
+/// waits for at most one other transaction.
+enum eI2CPriority
+{
+    I2C_PRIORITY_HIGH,  ///< Time critical e.g. the oscillator
+    I2C_PRIORITY_LOW,   ///< Can be delayed e.g. the display
+    I2C_NUM_PRIORITIES
+};
+
+/// Set the priority of the transactions with a device.
+///
+/// Applies to the blocking functions when I2C_ASYNC is defined.
+/// Devices default to high priority.
+///
+/// @param[in] addr I2C address
+/// @param[in] priority Priority of the device's transactions
+/// @returns true if successful
+/// @returns false if too many devices have their own priority
+bool i2cSetDevicePriority( uint8_t addr, enum eI2CPriority priority );
+
+/// Descriptor for an asynchronous I2C transaction.
+///
+/// The descriptor and its buffer belong to the caller and must
+/// remain valid until the transaction has completed.
+struct sI2CTransaction
+{
+    uint8_t addr;                       ///< I2C address
+    uint8_t reg;                        ///< Address of the first register
+    uint8_t *buf;                       ///< Data to write or buffer to read into
+    uint8_t len;                        ///< Number of registers
+    bool    bRead;                      ///< true to read, false to write
+    bool    bNoReg;                     ///< Write the data alone with no register address
+    enum eI2CPriority priority;         ///< Queue to wait in
+    volatile enum eI2CStatus status;    ///< Progress of the transaction
+    volatile uint8_t error;             ///< Error code as returned by the blocking functions
+
+    /// Called on completion or null if not required.
+    /// This is called from interrupt context so must be short.
+    void (*callback)( struct sI2CTransaction *pTrans );
+};
+
+/// Queue an I2C transaction without waiting for it to complete.
+///
+/// Only available when I2C_ASYNC is defined. On the ATmega and tinyAVR
+/// the transaction is driven by the TWI interrupt. The USI has no
+/// interrupt support so the transaction completes before returning.
+///
+/// @param[in] pTrans Pointer to the transaction descriptor
+/// @returns true if queued
+/// @returns false if the queue is full
+bool i2cQueue( struct sI2CTransaction *pTrans );
+
+/// Wait for a queued transaction to complete.
+///
+/// @param[in] pTrans Pointer to the transaction descriptor
+/// @return 0 if successful otherwise the error code
+uint8_t i2cWait( struct sI2CTransaction *pTrans );
+
+/// Find out if the I2C bus is in use.
+///
+/// @returns true if a transaction is active or queued
+bool i2cBusy( void );
+
+/// Number of bytes needed for the valid flags of a cache of n registers.
+#define I2C_CACHE_VALID_LEN(n) (((n)+7)/8)
+
+/// Shadow copy of a block of a device's registers.
+///
+/// The storage belongs to the caller. A device may have several
+/// caches covering different blocks of registers.
+struct sI2CCache
+{
+    uint8_t addr;               ///< I2C address
+    uint8_t firstReg;           ///< First register cached
+    uint8_t numRegs;            ///< Number of registers cached
+    bool    bRegisterless;      ///< Device has no register address e.g. a port expander
+    uint8_t *regs;              ///< Shadow copy of the registers
+    uint8_t *valid;             ///< Bit set for each register whose shadow copy is known
+    struct sI2CCache *pNext;    ///< Used internally to link the caches
+};
+
+/// Add a register cache.
+///
+/// Initially all the registers are unknown. Adding the same cache
+/// again has no effect.
+///
+/// @param[in] pCache Pointer to the cache
+void i2cCacheAdd( struct sI2CCache *pCache );
+
+/// Write to an 8 bit register through the cache.
+///
+/// Nothing is sent if the register is known to already hold the value.
+/// For a registerless device only the data is sent.
+///
+/// @param[in] addr I2C address
+/// @param[in] reg Register address
+/// @param[in] data Data to write to register
+uint8_t i2cCacheWriteRegister(uint8_t addr, uint8_t reg, uint8_t data);
+
+/// Write to a block of consecutive 8 bit registers through the cache.
+///
+/// Only the changed registers are sent. Each run of changed registers
+/// is sent as one transaction. Runs separated by no more than
+/// I2C_CACHE_RUN_GAP (default 2) unchanged registers are joined as
+/// that is cheaper than the extra start, address and register bytes.
+///
+/// @param[in] addr I2C address
+/// @param[in] startReg Address of the first register
+/// @param[in] buf Pointer to the data to write
+/// @param[in] len Number of registers to write
+uint8_t i2cCacheWriteRegisters(uint8_t addr, uint8_t startReg, const uint8_t *buf, uint8_t len);
+
+/// Read from an 8 bit register through the cache.
+///
+/// If the register value is known it is returned without using the bus.
+///
+/// @param[in] addr I2C address
+/// @param[in] reg Register address
+/// @param[out] data Pointer to data location to write contents of register to
+uint8_t i2cCacheReadRegister(uint8_t addr, uint8_t reg, uint8_t *data);
+
+/// Forget the values of all the cached registers for a device.
+///
+/// Use this if the device may have been reset.
+///
+/// @param[in] addr I2C address
+void i2cCacheInvalidate( uint8_t addr );
+
+/// Forget the value of a single cached register so that the
+/// next write is always sent.
+///
+/// @param[in] addr I2C address
+/// @param[in] reg Register address
+void i2cCacheInvalidateRegister( uint8_t addr, uint8_t reg );
+
+/// Counters for one device.
+///
+/// Only available when I2C_STATS is defined.
+struct sI2CStats
+{
+    uint8_t  addr;              ///< I2C address
+    uint16_t transactions;      ///< Number of transactions
+    uint32_t bytes;             ///< Number of register bytes transferred
+    uint16_t nacks;             ///< Transactions that failed because a byte was not acknowledged
+    uint16_t timeouts;          ///< Transactions that timed out
+    uint32_t waits;             ///< Busy wait loop iterations spent waiting for the bus
+};
+
+/// Record of one transaction in the trace.
+struct sI2CTrace
+{
+    uint32_t time;              ///< Start time in microseconds
+    uint16_t duration;          ///< Time taken in microseconds
+    uint8_t  addr;              ///< I2C address
+    uint8_t  reg;               ///< Address of the first register
+    uint8_t  len;               ///< Number of registers
+    uint8_t  status;            ///< 0 if successful otherwise the error code
+};
+
+/// Get the counters for a device.
+///
+/// Only available when I2C_STATS is defined. The counters for up to
+/// I2C_STATS_DEVICES devices are kept and the last I2C_TRACE_LEN
+/// transactions are traced.
+///
+/// @param[in] addr I2C address
+/// @return Pointer to the counters or null if the device has not been used
+const struct sI2CStats *i2cGetStats( uint8_t addr );
+
+/// Clear all the counters and the trace.
+void i2cResetStats( void );
+
+/// Send one line of the counters and trace to the serial port.
+///
+/// The device counters are sent first, one device per line, followed
+/// by the trace records oldest first. Sending a line at a time keeps
+/// within the serial transmit buffer.
+///
+/// @param[in] line Line number starting from 0
+/// @returns true if the line was sent
+/// @returns false if there are no more lines
+bool i2cDumpStats( uint8_t line );
+
 #endif //I2C_H
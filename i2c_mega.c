@@ -1,6 +1,8 @@
 #include <inttypes.h>
+#include <stdbool.h>
 #include <avr/io.h>
 #include <avr/pgmspace.h>
+#include <avr/interrupt.h>
 #include "i2c.h"
 
 #define I2C_START 0x08
@@ -8,20 +10,20 @@
 #define I2C_SLA_W_ACK 0x18
 #define I2C_SLA_R_ACK 0x40
 #define I2C_DATA_ACK 0x28
+#define I2C_DATA_RX_ACK 0x50
+#define I2C_DATA_RX_NACK 0x58
 
 #define I2C_TIMEOUT 0xFF
 
-#define MAX_ITERATIONS 1000
+#ifndef I2C_ASYNC
 
 static uint8_t i2cStart()
 {
-    int i;
-
     TWCR = (1<<TWINT) | (1<<TWSTA) | (1<<TWEN);
 
-    for ( i = 0 ; (i < MAX_ITERATIONS) && !(TWCR & (1<<TWINT)) ; i++);
+    while( !(TWCR & (1<<TWINT)) && !i2cTimedOut() );
 
-    if( i == MAX_ITERATIONS )
+    if( !(TWCR & (1<<TWINT)) )
     {
         return I2C_TIMEOUT;
     }
@@ -33,24 +35,20 @@ static uint8_t i2cStart()
 
 static void i2cStop()
 {
-    int i;
-
     TWCR = (1<<TWINT) | (1<<TWEN) | (1<<TWSTO);
 
-    for ( i = 0 ; (i < MAX_ITERATIONS) && (TWCR & (1<<TWSTO)) ; i++);
+    while( (TWCR & (1<<TWSTO)) && !i2cTimedOut() );
 }
 
 static uint8_t i2cByteSend(uint8_t data)
 {
-    int i;
-
     TWDR = data;
 
     TWCR = (1<<TWINT) | (1<<TWEN);
 
-    for ( i = 0 ; (i < MAX_ITERATIONS) && !(TWCR & (1<<TWINT)) ; i++);
+    while( !(TWCR & (1<<TWINT)) && !i2cTimedOut() );
 
-    if( i == MAX_ITERATIONS )
+    if( !(TWCR & (1<<TWINT)) )
     {
         return I2C_TIMEOUT;
     }
@@ -60,27 +58,30 @@ static uint8_t i2cByteSend(uint8_t data)
     }
 }
 
-static uint8_t i2cByteRead()
+// Read a byte and then ACK it if more are to follow or NACK
+// it if it is the last byte
+static uint8_t i2cByteRead(uint8_t *data, bool bAck)
 {
-    int i;
-
-    TWCR = (1<<TWINT) | (1<<TWEN);
+    TWCR = (1<<TWINT) | (1<<TWEN) | (bAck ? (1<<TWEA) : 0);
 
-    for ( i = 0 ; (i < MAX_ITERATIONS) && !(TWCR & (1<<TWINT)) ; i++);
+    while( !(TWCR & (1<<TWINT)) && !i2cTimedOut() );
 
-    if( i == MAX_ITERATIONS )
+    if( !(TWCR & (1<<TWINT)) )
     {
         return I2C_TIMEOUT;
     }
     else
     {
-        return (TWDR);
+        *data = TWDR;
+        return (TWSR & 0xF8);
     }
 }
 
-uint8_t i2cWriteRegister(uint8_t addr, uint8_t reg, uint8_t data)
+// Write with the register address if pReg is not null
+static uint8_t i2cWriteBlock(uint8_t addr, const uint8_t *pReg, const uint8_t *buf, uint8_t len)
 {
     uint8_t stts;
+    uint8_t i;
     
     stts = i2cStart();
     if (stts != I2C_START) return 1;
@@ -92,20 +93,36 @@ uint8_t i2cWriteRegister(uint8_t addr, uint8_t reg, uint8_t data)
         return 2;
     }
 
-    stts = i2cByteSend(reg);
-    if (stts != I2C_DATA_ACK) return 3;
+    if( pReg )
+    {
+        stts = i2cByteSend(*pReg);
+        if (stts != I2C_DATA_ACK)
+        {
+            i2cStop();
+            return 3;
+        }
+    }
 
-    stts = i2cByteSend(data);
-    if (stts != I2C_DATA_ACK) return 4;
+    // The device auto-increments the register address after each byte
+    for( i = 0 ; i < len ; i++ )
+    {
+        stts = i2cByteSend(buf[i]);
+        if (stts != I2C_DATA_ACK)
+        {
+            i2cStop();
+            return 4;
+        }
+    }
 
     i2cStop();
 
     return 0;
 }
 
-uint8_t i2cReadRegister(uint8_t addr, uint8_t reg, uint8_t *data)
+static uint8_t i2cReadBlock(uint8_t addr, uint8_t startReg, uint8_t *buf, uint8_t len)
 {
     uint8_t stts;
+    uint8_t i;
     
     stts = i2cStart();
     if (stts != I2C_START) return 1;
@@ -117,11 +134,19 @@ uint8_t i2cReadRegister(uint8_t addr, uint8_t reg, uint8_t *data)
         return 2;
     }
  
-    stts = i2cByteSend(reg);
-    if (stts != I2C_DATA_ACK) return 3;
+    stts = i2cByteSend(startReg);
+    if (stts != I2C_DATA_ACK)
+    {
+        i2cStop();
+        return 3;
+    }
 
     stts = i2cStart();
-    if (stts != I2C_START_RPT) return 4;
+    if (stts != I2C_START_RPT)
+    {
+        i2cStop();
+        return 4;
+    }
 
     stts = i2cByteSend((addr<<1)|1);
     if (stts != I2C_SLA_R_ACK)
@@ -130,19 +155,249 @@ uint8_t i2cReadRegister(uint8_t addr, uint8_t reg, uint8_t *data)
         return 5;
     }
 
-    *data = i2cByteRead();
+    // ACK every byte except the last
+    for( i = 0 ; i < len ; i++ )
+    {
+        bool bAck = (i < (len - 1));
+
+        stts = i2cByteRead(&buf[i], bAck);
+        if (stts != (bAck ? I2C_DATA_RX_ACK : I2C_DATA_RX_NACK))
+        {
+            i2cStop();
+            return 6;
+        }
+    }
 
     i2cStop();
 
     return 0;
 }
 
+#else
+
+#define I2C_INTERRUPT_DRIVEN
+
+// TWCR value to continue the transaction with the interrupt enabled
+#define TWCR_NEXT ((1<<TWINT) | (1<<TWEN) | (1<<TWIE))
+
+// The transaction being driven by the interrupt
+static struct sI2CTransaction *pI2CTrans;
+
+// Position in the transaction's buffer
+static uint8_t i2cPos;
+
+// Step of the transaction in progress. These are numbered as the
+// error codes returned by the blocking functions if the step fails.
+static uint8_t i2cStep;
+
+static void i2cTransferStart( struct sI2CTransaction *pTrans )
+{
+    pI2CTrans = pTrans;
+    i2cPos = 0;
+    i2cStep = 1;
+
+    // Wait for the previous stop condition to complete
+    while( (TWCR & (1<<TWSTO)) && !i2cTimedOut() );
+
+    TWCR = TWCR_NEXT | (1<<TWSTA);
+}
+
+// Send a stop and finish the transaction
+static void i2cTransferEnd( uint8_t error )
+{
+    TWCR = (1<<TWINT) | (1<<TWEN) | (1<<TWSTO);
+
+    i2cTransferComplete( error );
+}
+
+// Move the transaction on to the next step according to the
+// status of the last one
+static void i2cService()
+{
+    switch( TWSR & 0xF8 )
+    {
+        case I2C_START:
+            i2cStep = 2;
+            TWDR = (pI2CTrans->addr<<1)|0;
+            TWCR = TWCR_NEXT;
+            break;
+
+        case I2C_SLA_W_ACK:
+            if( !pI2CTrans->bNoReg )
+            {
+                i2cStep = 3;
+                TWDR = pI2CTrans->reg;
+                TWCR = TWCR_NEXT;
+                break;
+            }
+            // No register address so go straight on to the data
+            // fall through
+        case I2C_DATA_ACK:
+            if( (i2cStep == 3) && pI2CTrans->bRead )
+            {
+                // Register address sent so repeated start to read
+                i2cStep = 4;
+                TWCR = TWCR_NEXT | (1<<TWSTA);
+            }
+            else if( i2cPos < pI2CTrans->len )
+            {
+                i2cStep = 4;
+                TWDR = pI2CTrans->buf[i2cPos++];
+                TWCR = TWCR_NEXT;
+            }
+            else
+            {
+                i2cTransferEnd( 0 );
+            }
+            break;
+
+        case I2C_START_RPT:
+            i2cStep = 5;
+            TWDR = (pI2CTrans->addr<<1)|1;
+            TWCR = TWCR_NEXT;
+            break;
+
+        case I2C_SLA_R_ACK:
+            // ACK every byte except the last
+            i2cStep = 6;
+            TWCR = TWCR_NEXT | ((pI2CTrans->len > 1) ? (1<<TWEA) : 0);
+            break;
+
+        case I2C_DATA_RX_ACK:
+            pI2CTrans->buf[i2cPos++] = TWDR;
+            TWCR = TWCR_NEXT | ((i2cPos < (pI2CTrans->len - 1)) ? (1<<TWEA) : 0);
+            break;
+
+        case I2C_DATA_RX_NACK:
+            pI2CTrans->buf[i2cPos++] = TWDR;
+            i2cTransferEnd( 0 );
+            break;
+
+        default:
+            // Not acknowledged or bus error
+            i2cTransferEnd( i2cStep );
+            break;
+    }
+}
+
+ISR(TWI_vect)
+{
+    i2cService();
+}
+
+// Drive the transaction if interrupts are disabled
+static void i2cPoll()
+{
+    if( !(SREG & (1<<SREG_I)) && (TWCR & (1<<TWINT)) )
+    {
+        i2cService();
+    }
+}
+
+#endif
+
+// Work out the TWBR and TWPS values for a clock rate.
+// SCL = F_CPU / (16 + 2 * TWBR * 4^TWPS)
+// Use the smallest prescaler that fits and round up the divider
+// so that the rate never exceeds that requested.
+static uint16_t i2cClockSetting( uint32_t hz )
+{
+    uint32_t div = (F_CPU + hz - 1) / hz;
+    uint32_t twbr = 0;
+    uint8_t twps;
+
+    for( twps = 0 ; twps < 4 ; twps++ )
+    {
+        uint32_t prescale = 2UL << (2 * twps);
+
+        twbr = (div > 16) ? ((div - 16 + prescale - 1) / prescale) : 0;
+        if( twbr <= 0xFF )
+        {
+            break;
+        }
+    }
+
+    // Slowest possible rate
+    if( twps == 4 )
+    {
+        twps = 3;
+        twbr = 0xFF;
+    }
+
+    return (twps << 8) | twbr;
+}
+
+static void i2cApplyClockSetting( uint16_t setting )
+{
+    // Wait for any stop condition to complete
+    while( (TWCR & (1<<TWSTO)) && !i2cTimedOut() );
+
+    TWBR = setting & 0xFF;
+    TWSR = (setting >> 8) & ((1<<TWPS1) | (1<<TWPS0));
+}
+
+// TWI pins used for bus recovery
+// These can be overridden in config.h
+#ifndef I2C_GPIO_PORT
+#if defined(__AVR_ATmega48__) || defined(__AVR_ATmega48P__) || defined(__AVR_ATmega88__) || defined(__AVR_ATmega88P__) \
+    || defined(__AVR_ATmega168__) || defined(__AVR_ATmega168P__) || defined(__AVR_ATmega328__) || defined(__AVR_ATmega328P__) \
+    || defined(__AVR_ATmega328PB__)
+#define I2C_GPIO_PORT   PORTC
+#define I2C_GPIO_DDR    DDRC
+#define I2C_GPIO_PIN    PINC
+#define I2C_SDA_BIT     4
+#define I2C_SCL_BIT     5
+#elif defined(__AVR_ATmega16__) || defined(__AVR_ATmega32__) || defined(__AVR_ATmega164P__) || defined(__AVR_ATmega324P__) \
+    || defined(__AVR_ATmega644P__) || defined(__AVR_ATmega1284P__)
+#define I2C_GPIO_PORT   PORTC
+#define I2C_GPIO_DDR    DDRC
+#define I2C_GPIO_PIN    PINC
+#define I2C_SDA_BIT     1
+#define I2C_SCL_BIT     0
+#elif defined(__AVR_ATmega32U4__) || defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(__AVR_ATmega128__) \
+    || defined(__AVR_ATmega64__)
+#define I2C_GPIO_PORT   PORTD
+#define I2C_GPIO_DDR    DDRD
+#define I2C_GPIO_PIN    PIND
+#define I2C_SDA_BIT     1
+#define I2C_SCL_BIT     0
+#endif
+#endif
+
+// Open drain control of the pins for bus recovery.
+// The port bits are low so setting the direction to output
+// pulls the line low and setting it to input releases it.
+#ifdef I2C_GPIO_PORT
+#define I2C_SCL_LOW()       (I2C_GPIO_DDR |= (1<<I2C_SCL_BIT))
+#define I2C_SCL_RELEASE()   (I2C_GPIO_DDR &= ~(1<<I2C_SCL_BIT))
+#define I2C_SDA_LOW()       (I2C_GPIO_DDR |= (1<<I2C_SDA_BIT))
+#define I2C_SDA_RELEASE()   (I2C_GPIO_DDR &= ~(1<<I2C_SDA_BIT))
+#define I2C_SCL_HIGH()      (I2C_GPIO_PIN & (1<<I2C_SCL_BIT))
+#define I2C_SDA_HIGH()      (I2C_GPIO_PIN & (1<<I2C_SDA_BIT))
+#endif
+
+// Disable the TWI so the pins can be driven directly
+static void i2cDisable()
+{
+    TWCR = 0;
+#ifdef I2C_GPIO_PORT
+    I2C_GPIO_PORT &= ~((1<<I2C_SDA_BIT) | (1<<I2C_SCL_BIT));
+    I2C_SCL_RELEASE();
+    I2C_SDA_RELEASE();
+#endif
+}
+
+// Give the pins back to the TWI
+static void i2cEnable()
+{
+    TWCR = (1<<TWEN);
+}
+
 // Init TWI (I2C)
 //
 void i2cInit()
 {
-    TWBR = 2; // 800kbps
-    TWSR = 0;
-    TWDR = 0xFF;
     PRR = 0;
-}
+    i2cSetClock( I2C_CLOCK_RATE );
+    TWDR = 0xFF;
+}
\ No newline at end of file
@@ -0,0 +1,925 @@
+/*
+ * i2c_sim.c
+ *
+ * Simulated I2C backend for building off-target e.g. on Linux.
+ *
+ * Included by i2c.c when not compiling for an AVR. Each transaction
+ * is passed a byte at a time to the device model attached at the
+ * address. Bus time is calculated from the clock rate and added to
+ * the simulated time base which replaces millis.c in a host build.
+ *
+ * With I2C_ASYNC the backend is interrupt driven. A transaction is
+ * passed to the model when it starts and completes, as if from the
+ * TWI interrupt, once its bus time has passed in simulated time.
+ *
+ */
+
+#include <string.h>
+
+#include "i2c_sim.h"
+
+// No interrupts to protect against
+#ifndef ATOMIC_BLOCK
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_BLOCK( type ) for( uint8_t atomicDone = 0 ; !atomicDone ; atomicDone = 1 )
+#endif
+
+// Simulated time in microseconds
+static uint64_t simTime;
+
+// Set when millis() and micros() are held at simStoppedTime
+static bool bSimTimerStopped;
+static uint64_t simStoppedTime;
+
+// Called at each millisecond if set
+static void (*simTickCallback)( void );
+
+// Current bus clock rate
+static uint32_t simClockRate = 100000;
+
+// Linked list of attached devices
+static struct sI2CSimDevice *pSimDevices;
+
+// Counters for the bus and the number of bits clocked
+// in the current transaction
+static struct sI2CSimStats simStats;
+static uint32_t simBits;
+
+// Bus time of the last transaction
+static uint32_t simBusTime;
+
+#ifdef I2C_ASYNC
+#define I2C_INTERRUPT_DRIVEN
+
+// Set when a transaction is on the bus with when it completes
+// and its result
+static bool bSimActive;
+static uint64_t simActiveEnd;
+static uint8_t simActiveError;
+#endif
+
+uint32_t millis()
+{
+    return (bSimTimerStopped ? simStoppedTime : simTime) / 1000;
+}
+
+uint32_t micros()
+{
+    return bSimTimerStopped ? simStoppedTime : simTime;
+}
+
+void i2cSimStopTimer( bool bStopped )
+{
+    bSimTimerStopped = bStopped;
+    simStoppedTime = simTime;
+}
+
+void millisInit(void)
+{
+}
+
+void millisSetTickCallback( void (*callback)( void ) )
+{
+    simTickCallback = callback;
+}
+
+// Advance the time calling the tick callback at each millisecond
+// and completing the transaction on the bus when it is due
+static void simAdvance( uint64_t us )
+{
+    uint64_t endTime = simTime + us;
+
+    for( ;; )
+    {
+        uint64_t tick = (simTime / 1000 + 1) * 1000;
+
+#ifdef I2C_ASYNC
+        if( bSimActive && (simActiveEnd <= endTime) && (!simTickCallback || (simActiveEnd < tick)) )
+        {
+            simTime = simActiveEnd;
+            bSimActive = false;
+            i2cTransferComplete( simActiveError );
+            continue;
+        }
+#endif
+        if( simTickCallback && !bSimTimerStopped && (tick <= endTime) )
+        {
+            simTime = tick;
+            simTickCallback();
+            continue;
+        }
+
+        break;
+    }
+    simTime = endTime;
+}
+
+void delay( uint16_t ms )
+{
+    simAdvance( ms * 1000ULL );
+}
+
+void delayMicroseconds( uint32_t us )
+{
+    simAdvance( us );
+}
+
+void i2cSimAttach( struct sI2CSimDevice *pDev )
+{
+    struct sI2CSimDevice *p;
+
+    for( p = pSimDevices ; p ; p = p->pNext )
+    {
+        if( p == pDev )
+        {
+            return;
+        }
+    }
+
+    pDev->pNext = pSimDevices;
+    pSimDevices = pDev;
+}
+
+void i2cSimDetach( struct sI2CSimDevice *pDev )
+{
+    struct sI2CSimDevice **pp;
+
+    for( pp = &pSimDevices ; *pp ; pp = &(*pp)->pNext )
+    {
+        if( *pp == pDev )
+        {
+            *pp = pDev->pNext;
+            break;
+        }
+    }
+}
+
+const struct sI2CSimStats *i2cSimGetStats( void )
+{
+    return &simStats;
+}
+
+void i2cSimResetStats( void )
+{
+    struct sI2CSimDevice *p;
+
+    memset( &simStats, 0, sizeof(simStats) );
+
+    for( p = pSimDevices ; p ; p = p->pNext )
+    {
+        p->transactions = 0;
+        p->bytes = 0;
+    }
+}
+
+// Find the device at an address or null if none
+static struct sI2CSimDevice *simFind( uint8_t addr )
+{
+    struct sI2CSimDevice *p;
+
+    for( p = pSimDevices ; p ; p = p->pNext )
+    {
+        if( p->addr == addr )
+        {
+            break;
+        }
+    }
+
+    return p;
+}
+
+// Count a byte on the bus
+static void simCountByte( struct sI2CSimDevice *pDev )
+{
+    // 8 data bits and the ACK
+    simBits += 9;
+    simStats.bytes++;
+
+    if( pDev )
+    {
+        pDev->bytes++;
+    }
+}
+
+// Send a start and the address byte
+// Returns true if the device ACKed
+static bool simStart( struct sI2CSimDevice *pDev, bool bRead )
+{
+    simBits++;
+    simCountByte( pDev );
+
+    if( pDev && pDev->start )
+    {
+        pDev->start( pDev, bRead );
+    }
+
+    return pDev != 0;
+}
+
+// Write a byte
+// Returns true if the device ACKed
+static bool simWrite( struct sI2CSimDevice *pDev, uint8_t data )
+{
+    simCountByte( pDev );
+
+    return pDev->write ? pDev->write( pDev, data ) : true;
+}
+
+// Read a byte
+static uint8_t simRead( struct sI2CSimDevice *pDev )
+{
+    simCountByte( pDev );
+
+    return pDev->read ? pDev->read( pDev ) : 0xFF;
+}
+
+// Send a stop and account for the transaction
+static void simStop( struct sI2CSimDevice *pDev )
+{
+    uint32_t busTime;
+
+    simBits++;
+
+    if( pDev )
+    {
+        pDev->transactions++;
+        if( pDev->stop )
+        {
+            pDev->stop( pDev );
+        }
+    }
+
+    busTime = ((uint64_t) simBits * 1000000 + simClockRate - 1) / simClockRate;
+    simStats.transactions++;
+    simStats.busTime += busTime;
+    simBusTime = busTime;
+    simBits = 0;
+
+#ifndef I2C_ASYNC
+    simTime += busTime;
+#endif
+
+    // A clock too slow for the transaction times out as on the hardware
+    i2cTimedOut();
+}
+
+// Write with the register address if pReg is not null
+static uint8_t i2cWriteBlock( uint8_t addr, const uint8_t *pReg, const uint8_t *buf, uint8_t len )
+{
+    struct sI2CSimDevice *pDev = simFind( addr );
+    uint8_t result = 0;
+
+    if( !simStart( pDev, false ) )
+    {
+        result = 2;
+    }
+    else if( pReg && !simWrite( pDev, *pReg ) )
+    {
+        result = 3;
+    }
+    else
+    {
+        for( uint8_t i = 0 ; i < len ; i++ )
+        {
+            if( !simWrite( pDev, buf[i] ) )
+            {
+                result = 4;
+                break;
+            }
+        }
+    }
+
+    simStop( pDev );
+
+    return result;
+}
+
+static uint8_t i2cReadBlock( uint8_t addr, uint8_t startReg, uint8_t *buf, uint8_t len )
+{
+    struct sI2CSimDevice *pDev = simFind( addr );
+    uint8_t result = 0;
+
+    if( !simStart( pDev, false ) )
+    {
+        result = 2;
+    }
+    else if( !simWrite( pDev, startReg ) )
+    {
+        result = 3;
+    }
+    else if( !simStart( pDev, true ) )
+    {
+        result = 5;
+    }
+    else
+    {
+        for( uint8_t i = 0 ; i < len ; i++ )
+        {
+            buf[i] = simRead( pDev );
+        }
+    }
+
+    simStop( pDev );
+
+    return result;
+}
+
+#ifdef I2C_ASYNC
+// Pass the transaction to the model now and complete it
+// when its bus time has passed
+static void i2cTransferStart( struct sI2CTransaction *pTrans )
+{
+    if( pTrans->bRead )
+    {
+        simActiveError = i2cReadBlock( pTrans->addr, pTrans->reg, pTrans->buf, pTrans->len );
+    }
+    else
+    {
+        simActiveError = i2cWriteBlock( pTrans->addr, pTrans->bNoReg ? 0 : &pTrans->reg, pTrans->buf, pTrans->len );
+    }
+
+    simActiveEnd = simTime + simBusTime;
+    bSimActive = true;
+}
+
+// Wait for the transaction on the bus to complete
+static void i2cPoll( void )
+{
+    if( bSimActive )
+    {
+        simAdvance( simActiveEnd - simTime );
+    }
+}
+#endif
+
+// Bit-banged bus
+
+// What the slave side of the bit-banged bus is doing
+enum eSimSoftState
+{
+    SIM_SOFT_IDLE,      // Waiting for a start
+    SIM_SOFT_ADDRESS,   // Receiving the address byte
+    SIM_SOFT_WRITE,     // Receiving data bytes
+    SIM_SOFT_READ       // Sending data bytes
+};
+
+static struct
+{
+    struct sI2CSimDevice *pDevices; // Attached devices
+    struct sI2CSimDevice *pDev;     // Device addressed or null
+    enum eSimSoftState state;
+    bool    bSclLow, bSdaLow;       // Lines pulled low by the master
+    bool    bSlaveSdaLow;           // SDA pulled low by the slave
+    bool    bScl, bSda;             // Line levels last seen
+    uint8_t bit;                    // Bit of the byte, 8 for the ACK
+    uint8_t shift;                  // Byte being received or sent
+    bool    bAck;                   // The byte is acknowledged
+    uint8_t holdSDA;                // Clocks left with SDA held low
+    uint64_t holdSCLEnd;            // Time until which SCL is held low
+} simSoft = { 0, 0, SIM_SOFT_IDLE, false, false, false, true, true, 0, 0, false, 0, 0 };
+
+// Find a device on the bit-banged bus
+static struct sI2CSimDevice *simSoftFind( uint8_t addr )
+{
+    struct sI2CSimDevice *p;
+
+    for( p = simSoft.pDevices ; p ; p = p->pNext )
+    {
+        if( p->addr == addr )
+        {
+            break;
+        }
+    }
+
+    return p;
+}
+
+// A byte has been received so pass it to the device and work out
+// whether to acknowledge it
+static void simSoftByte( void )
+{
+    if( simSoft.state == SIM_SOFT_ADDRESS )
+    {
+        simSoft.pDev = simSoftFind( simSoft.shift >> 1 );
+        simSoft.bAck = (simSoft.pDev != 0);
+        if( simSoft.pDev )
+        {
+            simSoft.pDev->bytes++;
+            if( simSoft.pDev->start )
+            {
+                simSoft.pDev->start( simSoft.pDev, simSoft.shift & 1 );
+            }
+            simSoft.state = (simSoft.shift & 1) ? SIM_SOFT_READ : SIM_SOFT_WRITE;
+        }
+    }
+    else
+    {
+        simSoft.pDev->bytes++;
+        simSoft.bAck = simSoft.pDev->write ? simSoft.pDev->write( simSoft.pDev, simSoft.shift ) : true;
+    }
+}
+
+// Load the next byte for the master to read
+static void simSoftLoad( void )
+{
+    simSoft.shift = simSoft.pDev->read ? simSoft.pDev->read( simSoft.pDev ) : 0xFF;
+    simSoft.pDev->bytes++;
+    simSoft.bit = 0;
+    simSoft.bSlaveSdaLow = !(simSoft.shift & 0x80);
+}
+
+// The slave acts on the clock edges. Bits are sampled as SCL rises
+// and the slave changes SDA after SCL falls.
+static void simSoftClock( bool bRising, bool bSda )
+{
+    if( bRising )
+    {
+        if( (simSoft.state == SIM_SOFT_READ) && (simSoft.bit == 8) )
+        {
+            // The master acknowledges to ask for another byte
+            simSoft.bAck = !bSda;
+        }
+        else if( (simSoft.state != SIM_SOFT_READ) && (simSoft.state != SIM_SOFT_IDLE) && (simSoft.bit < 8) )
+        {
+            simSoft.shift = (simSoft.shift << 1) | bSda;
+            simSoft.bit++;
+        }
+        return;
+    }
+
+    // A stuck slave lets go after a number of clocks
+    if( (simSoft.holdSDA != 0) && (simSoft.holdSDA != 0xFF) )
+    {
+        simSoft.holdSDA--;
+    }
+
+    switch( simSoft.state )
+    {
+        case SIM_SOFT_IDLE:
+            break;
+
+        case SIM_SOFT_ADDRESS:
+        case SIM_SOFT_WRITE:
+            if( simSoft.bit == 8 )
+            {
+                // Drive the acknowledge
+                simSoftByte();
+                simSoft.bSlaveSdaLow = simSoft.bAck;
+                simSoft.bit = 9;
+            }
+            else if( simSoft.bit == 9 )
+            {
+                // End of the acknowledge
+                simSoft.bSlaveSdaLow = false;
+                simSoft.bit = 0;
+                if( !simSoft.bAck )
+                {
+                    simSoft.state = SIM_SOFT_IDLE;
+                }
+            }
+            break;
+
+        case SIM_SOFT_READ:
+            if( simSoft.bit == 9 )
+            {
+                // End of the address acknowledge
+                simSoftLoad();
+            }
+            else if( simSoft.bit < 7 )
+            {
+                simSoft.bit++;
+                simSoft.bSlaveSdaLow = !(simSoft.shift & (0x80 >> simSoft.bit));
+            }
+            else if( simSoft.bit == 7 )
+            {
+                // Release SDA for the master's acknowledge
+                simSoft.bit = 8;
+                simSoft.bSlaveSdaLow = false;
+            }
+            else if( simSoft.bAck )
+            {
+                simSoftLoad();
+            }
+            else
+            {
+                simSoft.state = SIM_SOFT_IDLE;
+            }
+            break;
+    }
+}
+
+// Work out the line levels and act on any changes
+static void simSoftUpdate( void )
+{
+    bool bScl = !simSoft.bSclLow && (simTime >= simSoft.holdSCLEnd);
+    bool bSda = !simSoft.bSdaLow && !simSoft.bSlaveSdaLow && (simSoft.holdSDA == 0);
+
+    if( bScl != simSoft.bScl )
+    {
+        simSoft.bScl = bScl;
+        simSoftClock( bScl, simSoft.bSda );
+
+        // The slave may have changed SDA
+        bSda = !simSoft.bSdaLow && !simSoft.bSlaveSdaLow && (simSoft.holdSDA == 0);
+    }
+
+    if( (bSda != simSoft.bSda) && bScl )
+    {
+        if( !bSda )
+        {
+            // Start or repeated start
+            simSoft.state = SIM_SOFT_ADDRESS;
+            simSoft.bit = 0;
+            simSoft.bSlaveSdaLow = false;
+        }
+        else
+        {
+            // Stop
+            if( simSoft.pDev )
+            {
+                simSoft.pDev->transactions++;
+                if( simSoft.pDev->stop )
+                {
+                    simSoft.pDev->stop( simSoft.pDev );
+                }
+            }
+            simSoft.state = SIM_SOFT_IDLE;
+            simSoft.pDev = 0;
+        }
+    }
+    simSoft.bSda = bSda;
+}
+
+void i2cSimSoftDrive( uint8_t line, bool bLow )
+{
+    simSoftUpdate();
+
+    if( line == I2C_SIM_SCL )
+    {
+        simSoft.bSclLow = bLow;
+    }
+    else
+    {
+        simSoft.bSdaLow = bLow;
+    }
+
+    simSoftUpdate();
+}
+
+bool i2cSimSoftHigh( uint8_t line )
+{
+    simSoftUpdate();
+
+    return (line == I2C_SIM_SCL) ? simSoft.bScl : simSoft.bSda;
+}
+
+void i2cSimSoftAttach( struct sI2CSimDevice *pDev )
+{
+    pDev->pNext = simSoft.pDevices;
+    simSoft.pDevices = pDev;
+}
+
+// The slave is stuck part way through a byte so this isn't a start
+void i2cSimSoftHoldSDA( uint8_t clocks )
+{
+    simSoftUpdate();
+    simSoft.holdSDA = clocks;
+    simSoft.bSda = simSoft.bSda && (clocks == 0);
+}
+
+void i2cSimSoftHoldSCL( uint32_t us )
+{
+    simSoft.holdSCLEnd = simTime + us;
+    simSoftUpdate();
+}
+
+// The setting is the clock rate in units of 100Hz
+static uint16_t i2cClockSetting( uint32_t hz )
+{
+    uint32_t setting = hz / 100;
+
+    if( setting == 0 )
+    {
+        setting = 1;
+    }
+    else if( setting > 0xFFFF )
+    {
+        setting = 0xFFFF;
+    }
+
+    return setting;
+}
+
+static void i2cApplyClockSetting( uint16_t setting )
+{
+    simClockRate = setting * 100UL;
+}
+
+// No pins to hand over
+static void i2cDisable( void )
+{
+}
+
+static void i2cEnable( void )
+{
+}
+
+void i2cInit()
+{
+    i2cSetClock( I2C_CLOCK_RATE );
+}
+
+// Si5351A model
+
+#define SI_SIM_PLL_RESET    177
+#define SI_SIM_PLL_RESET_A  0x20
+#define SI_SIM_PLL_RESET_B  0x80
+
+#define SI_SIM_CLK_ENABLE   3
+#define SI_SIM_CLK0_CONTROL 16
+#define SI_SIM_SYNTH_PLL_A  26
+#define SI_SIM_SYNTH_PLL_B  34
+#define SI_SIM_SYNTH_MS_0   42
+#define SI_SIM_SYNTH_MS_6   90
+#define SI_SIM_R_DIV_67     92
+
+// Clock control register bits
+#define SI_SIM_CLK_PDN      0x80
+#define SI_SIM_CLK_SRC_MS   0x0C
+#define SI_SIM_CLK_PLL_B    0x20
+
+static void si5351SimStart( struct sI2CSimDevice *pDev, bool bRead )
+{
+    struct sSi5351Sim *pSi = (struct sSi5351Sim *) pDev;
+
+    // A write starts with the register address
+    if( !bRead )
+    {
+        pSi->bGotReg = false;
+    }
+}
+
+static bool si5351SimWrite( struct sI2CSimDevice *pDev, uint8_t data )
+{
+    struct sSi5351Sim *pSi = (struct sSi5351Sim *) pDev;
+
+    if( !pSi->bGotReg )
+    {
+        pSi->reg = data;
+        pSi->bGotReg = true;
+    }
+    else if( pSi->reg == SI_SIM_PLL_RESET )
+    {
+        // Reset bits clear themselves
+        if( data & SI_SIM_PLL_RESET_A )
+        {
+            pSi->pllResetA++;
+        }
+        if( data & SI_SIM_PLL_RESET_B )
+        {
+            pSi->pllResetB++;
+        }
+        pSi->regs[pSi->reg++] = data & ~(SI_SIM_PLL_RESET_A | SI_SIM_PLL_RESET_B);
+    }
+    else
+    {
+        pSi->regs[pSi->reg++] = data;
+    }
+
+    return true;
+}
+
+static uint8_t si5351SimRead( struct sI2CSimDevice *pDev )
+{
+    struct sSi5351Sim *pSi = (struct sSi5351Sim *) pDev;
+
+    return pSi->regs[pSi->reg++];
+}
+
+// Decode the 8 registers of a PLL or multisynth into the ratio
+// (a + b/c) as num / den following AN619
+static void si5351SimDecode( const uint8_t *regs, uint64_t *pNum, uint64_t *pDen )
+{
+    uint32_t p1 = ((uint32_t) (regs[2] & 0x03) << 16) | ((uint32_t) regs[3] << 8) | regs[4];
+    uint32_t p2 = ((uint32_t) (regs[5] & 0x0F) << 16) | ((uint32_t) regs[6] << 8) | regs[7];
+    uint32_t p3 = ((uint32_t) (regs[5] >> 4) << 16) | ((uint32_t) regs[0] << 8) | regs[1];
+
+    // A zero denominator is treated as 1 as the fraction is then unused
+    if( p3 == 0 )
+    {
+        p3 = 1;
+    }
+
+    // P1 = 128a + floor(128b/c) - 512, P2 = 128b - c * floor(128b/c)
+    *pNum = ((uint64_t) p1 + 512) * p3 + p2;
+    *pDen = (uint64_t) p3 * 128;
+}
+
+double i2cSimSi5351Frequency( const struct sSi5351Sim *pSi, uint8_t clock, uint32_t xtalFreq )
+{
+    uint8_t control;
+    const uint8_t *pll;
+    uint64_t pllNum, pllDen, msNum, msDen;
+    uint8_t rDiv;
+
+    if( clock > 7 )
+    {
+        return 0;
+    }
+
+    control = pSi->regs[SI_SIM_CLK0_CONTROL + clock];
+    if( (pSi->regs[SI_SIM_CLK_ENABLE] & (1 << clock)) ||
+        (control & SI_SIM_CLK_PDN) ||
+        ((control & SI_SIM_CLK_SRC_MS) != SI_SIM_CLK_SRC_MS) )
+    {
+        return 0;
+    }
+
+    pll = &pSi->regs[(control & SI_SIM_CLK_PLL_B) ? SI_SIM_SYNTH_PLL_B : SI_SIM_SYNTH_PLL_A];
+    si5351SimDecode( pll, &pllNum, &pllDen );
+
+    if( clock >= 6 )
+    {
+        // Even integer dividers only and the R dividers share a register
+        msNum = pSi->regs[SI_SIM_SYNTH_MS_6 + clock - 6];
+        msDen = 1;
+        rDiv = (pSi->regs[SI_SIM_R_DIV_67] >> ((clock == 6) ? 0 : 4)) & 0x07;
+    }
+    else
+    {
+        const uint8_t *ms = &pSi->regs[SI_SIM_SYNTH_MS_0 + 8 * clock];
+
+        if( (ms[2] & 0x0C) == 0x0C )
+        {
+            // Divide by 4 mode
+            msNum = 4;
+            msDen = 1;
+        }
+        else
+        {
+            si5351SimDecode( ms, &msNum, &msDen );
+        }
+        rDiv = (ms[2] >> 4) & 0x07;
+    }
+
+    if( msNum == 0 )
+    {
+        return 0;
+    }
+
+    return (double) xtalFreq * ((long double) pllNum * msDen) / ((long double) pllDen * msNum * (1 << rDiv));
+}
+
+void i2cSimSi5351Init( struct sSi5351Sim *pSi, uint8_t addr )
+{
+    memset( pSi, 0, sizeof(*pSi) );
+    pSi->dev.addr = addr;
+    pSi->dev.start = si5351SimStart;
+    pSi->dev.write = si5351SimWrite;
+    pSi->dev.read = si5351SimRead;
+}
+
+// PCF8574 and HD44780 model
+
+// Expander bits as wired in lcd_i2c.c
+#define LCD_SIM_RS      0x01
+#define LCD_SIM_RW      0x02
+#define LCD_SIM_EN      0x04
+#define LCD_SIM_DATA_POS    4
+
+// LCD instructions - the highest bit set selects the instruction
+#define LCD_SIM_SET_DDRAM   0x80
+#define LCD_SIM_SET_CGRAM   0x40
+#define LCD_SIM_FUNCTION    0x20
+#define LCD_SIM_8BIT        0x10
+#define LCD_SIM_SHIFT       0x10
+#define LCD_SIM_CONTROL     0x08
+#define LCD_SIM_ENTRY       0x04
+#define LCD_SIM_INCREMENT   0x02
+#define LCD_SIM_HOME        0x02
+#define LCD_SIM_CLEAR       0x01
+
+static void lcdSimCommand( struct sLCDSim *pLCD, uint8_t value )
+{
+    pLCD->commands++;
+
+    if( value & LCD_SIM_SET_DDRAM )
+    {
+        pLCD->bCGRAM = false;
+        pLCD->addr = value & 0x7F;
+    }
+    else if( value & LCD_SIM_SET_CGRAM )
+    {
+        pLCD->bCGRAM = true;
+        pLCD->addr = value & 0x3F;
+    }
+    else if( value & LCD_SIM_FUNCTION )
+    {
+        pLCD->bFourBit = !(value & LCD_SIM_8BIT);
+        pLCD->bHighNibble = false;
+    }
+    else if( value & LCD_SIM_SHIFT )
+    {
+        // Cursor and display shifts don't change the memory
+    }
+    else if( value & LCD_SIM_CONTROL )
+    {
+        pLCD->displayControl = value;
+    }
+    else if( value & LCD_SIM_ENTRY )
+    {
+        pLCD->bIncrement = (value & LCD_SIM_INCREMENT) != 0;
+    }
+    else if( value & LCD_SIM_HOME )
+    {
+        pLCD->bCGRAM = false;
+        pLCD->addr = 0;
+    }
+    else if( value & LCD_SIM_CLEAR )
+    {
+        memset( pLCD->ddram, ' ', sizeof(pLCD->ddram) );
+        pLCD->bCGRAM = false;
+        pLCD->bIncrement = true;
+        pLCD->addr = 0;
+    }
+}
+
+static void lcdSimData( struct sLCDSim *pLCD, uint8_t value )
+{
+    pLCD->data++;
+
+    if( pLCD->bCGRAM )
+    {
+        pLCD->cgram[pLCD->addr] = value;
+        pLCD->addr = (pLCD->addr + (pLCD->bIncrement ? 1 : -1)) & 0x3F;
+    }
+    else
+    {
+        pLCD->ddram[pLCD->addr] = value;
+        pLCD->addr = (pLCD->addr + (pLCD->bIncrement ? 1 : -1)) & 0x7F;
+    }
+}
+
+// The LCD latches the data lines on the falling edge of EN
+static void lcdSimLatch( struct sLCDSim *pLCD, uint8_t port )
+{
+    uint8_t nibble = port >> LCD_SIM_DATA_POS;
+    uint8_t value;
+
+    if( !pLCD->bFourBit )
+    {
+        // Only the top 4 data lines are wired
+        value = nibble << 4;
+    }
+    else if( !pLCD->bHighNibble )
+    {
+        pLCD->nibble = nibble;
+        pLCD->bHighNibble = true;
+        return;
+    }
+    else
+    {
+        value = (pLCD->nibble << 4) | nibble;
+        pLCD->bHighNibble = false;
+    }
+
+    if( port & LCD_SIM_RS )
+    {
+        lcdSimData( pLCD, value );
+    }
+    else
+    {
+        lcdSimCommand( pLCD, value );
+    }
+}
+
+// Every byte written sets the expander outputs
+static bool lcdSimWrite( struct sI2CSimDevice *pDev, uint8_t data )
+{
+    struct sLCDSim *pLCD = (struct sLCDSim *) pDev;
+
+    if( (pLCD->port & LCD_SIM_EN) && !(data & LCD_SIM_EN) && !(data & LCD_SIM_RW) )
+    {
+        lcdSimLatch( pLCD, data );
+    }
+    pLCD->port = data;
+
+    return true;
+}
+
+static uint8_t lcdSimRead( struct sI2CSimDevice *pDev )
+{
+    struct sLCDSim *pLCD = (struct sLCDSim *) pDev;
+
+    return pLCD->port;
+}
+
+void i2cSimLCDInit( struct sLCDSim *pLCD, uint8_t addr )
+{
+    memset( pLCD, 0, sizeof(*pLCD) );
+    memset( pLCD->ddram, ' ', sizeof(pLCD->ddram) );
+    pLCD->bIncrement = true;
+    pLCD->dev.addr = addr;
+    pLCD->dev.write = lcdSimWrite;
+    pLCD->dev.read = lcdSimRead;
+}
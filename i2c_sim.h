@@ -0,0 +1,200 @@
+/** \file i2c_sim.h
+ *
+ * Simulated I2C bus for building and testing off-target.
+ *
+ * i2c.c uses this backend when not compiled for an AVR. Transactions
+ * are routed to device models attached to the bus. The backend also
+ * provides a simulated time base in place of millis.c which advances
+ * on each delay and by the time each transaction takes on the bus.
+ *
+ * \author Richard Tomlinson G4TGJ
+ */
+
+#ifndef I2C_SIM_H
+#define I2C_SIM_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+/// A device model attached to the simulated bus.
+///
+/// The model sees the bus a byte at a time. Any of the functions
+/// may be null if the model doesn't need them.
+struct sI2CSimDevice
+{
+    uint8_t addr;                                               ///< I2C address
+    void (*start)( struct sI2CSimDevice *pDev, bool bRead );    ///< Start or repeated start addressed to the device
+    bool (*write)( struct sI2CSimDevice *pDev, uint8_t data );  ///< Byte written, returns true to ACK
+    uint8_t (*read)( struct sI2CSimDevice *pDev );              ///< Byte read by the master
+    void (*stop)( struct sI2CSimDevice *pDev );                 ///< Stop at the end of the transaction
+
+    uint32_t transactions;      ///< Transactions addressed to the device
+    uint32_t bytes;             ///< Bytes on the bus including the address bytes
+    struct sI2CSimDevice *pNext;    ///< Used internally to link the devices
+};
+
+/// Counters for the whole simulated bus.
+struct sI2CSimStats
+{
+    uint32_t transactions;      ///< Number of transactions
+    uint32_t bytes;             ///< Bytes on the bus including the address bytes
+    uint32_t busTime;           ///< Time the bus was in use in microseconds
+};
+
+/// Attach a device model to the bus.
+///
+/// Attaching the same model again has no effect.
+///
+/// @param[in] pDev Pointer to the device model
+void i2cSimAttach( struct sI2CSimDevice *pDev );
+
+/// Remove a device model from the bus.
+///
+/// @param[in] pDev Pointer to the device model
+void i2cSimDetach( struct sI2CSimDevice *pDev );
+
+/// Get the bus counters.
+///
+/// @return Pointer to the counters
+const struct sI2CSimStats *i2cSimGetStats( void );
+
+/// Clear the bus counters and those of all the attached devices.
+void i2cSimResetStats( void );
+
+/// Stop or restart the simulated timer.
+///
+/// While stopped millis() and micros() don't advance and the tick
+/// callback isn't called, as when the timer interrupt isn't running.
+/// The bus still takes time so they jump on when restarted.
+///
+/// @param[in] bStopped true to stop the timer
+void i2cSimStopTimer( bool bStopped );
+
+/// @name Bit-banged bus
+/// In a host build i2c_soft.c drives and reads its pins through these
+/// functions. The bus is decoded a bit at a time into start, byte and
+/// stop events for the device models attached with i2cSimSoftAttach().
+/// It is separate from the hardware bus and its transactions aren't
+/// added to the bus counters. A device model can only be attached to
+/// one bus.
+/// @{
+#define I2C_SIM_SCL 0   ///< Clock line
+#define I2C_SIM_SDA 1   ///< Data line
+
+/// Pull a line low or release it.
+///
+/// @param[in] line I2C_SIM_SCL or I2C_SIM_SDA
+/// @param[in] bLow true to pull the line low
+void i2cSimSoftDrive( uint8_t line, bool bLow );
+
+/// Read a line.
+///
+/// @param[in] line I2C_SIM_SCL or I2C_SIM_SDA
+/// @returns true if the line is high
+bool i2cSimSoftHigh( uint8_t line );
+
+/// Attach a device model to the bit-banged bus.
+///
+/// @param[in] pDev Pointer to the device model
+void i2cSimSoftAttach( struct sI2CSimDevice *pDev );
+
+/// Hold SDA low as a slave stuck part way through a byte does.
+///
+/// @param[in] clocks Number of clocks before SDA is released or 0xFF to never release it
+void i2cSimSoftHoldSDA( uint8_t clocks );
+
+/// Hold SCL low as a slave stretching the clock does.
+///
+/// @param[in] us Time in microseconds from now that SCL is held low
+void i2cSimSoftHoldSCL( uint32_t us );
+/// @}
+
+/// Si5351A model.
+///
+/// A plain register file with auto-incrementing register address.
+/// The PLL reset register clears itself and each reset is counted.
+struct sSi5351Sim
+{
+    struct sI2CSimDevice dev;   ///< Must be first
+    uint8_t regs[256];          ///< Register contents
+    uint8_t reg;                ///< Current register address
+    bool    bGotReg;            ///< The register address has been written in this transaction
+    uint16_t pllResetA;         ///< Number of PLL A resets
+    uint16_t pllResetB;         ///< Number of PLL B resets
+};
+
+/// Initialise an Si5351A model.
+///
+/// The registers start at zero i.e. with initialisation complete.
+///
+/// @param[out] pSi Pointer to the model
+/// @param[in] addr I2C address
+void i2cSimSi5351Init( struct sSi5351Sim *pSi, uint8_t addr );
+
+/// Work out the frequency of a clock from the model's registers.
+///
+/// This is a golden model for checking the driver. It decodes P1, P2
+/// and P3 of the PLL and multisynth, the R divider, divide by 4 mode,
+/// the integer only multisynths of clocks 6 and 7 and the PLL and
+/// source selection in the clock control register, independently of
+/// si5351a.c. The PLL is assumed to be locked.
+///
+/// test/bench_osc.c links si5351a.c against the model and sweeps the
+/// frequencies with a fixed set of steps. Run it with make bench in the
+/// test directory for the table of errors and bus cost per band. The
+/// core of it is
+///
+///     i2cSimSi5351Init( &si, SI5351A_I2C_ADDRESS );
+///     i2cSimAttach( &si.dev );
+///     oscSetXtalFrequency( 27000000 );
+///     oscInit();
+///     oscClockEnable( 0, true );
+///     for( f = 8000 ; f <= 200000000 ; f += step )
+///     {
+///         i2cSimResetStats();
+///         oscSetFrequency( 0, f, 0 );
+///         error = i2cSimSi5351Frequency( &si, 0, 27000000 ) - f;
+///         // si.dev.bytes is the bus bytes for the call and
+///         // si.pllResetA the running count of PLL A resets
+///     }
+///
+/// @param[in] pSi Pointer to the model
+/// @param[in] clock Clock output
+/// @param[in] xtalFreq Crystal frequency in hertz
+/// @return Frequency in hertz or 0 if the output is off
+double i2cSimSi5351Frequency( const struct sSi5351Sim *pSi, uint8_t clock, uint32_t xtalFreq );
+
+/// PCF8574 port expander driving an HD44780 LCD.
+///
+/// The expander is wired as in lcd_i2c.c i.e. RS, RW, EN and backlight
+/// on bits 0 to 3 and the LCD data on bits 4 to 7. The LCD model
+/// latches data on the falling edge of EN and follows the 8 bit to 4 bit
+/// initialisation sequence.
+///
+/// The display rows start at DDRAM addresses 0x00, 0x40, 0x14 and 0x54.
+struct sLCDSim
+{
+    struct sI2CSimDevice dev;   ///< Must be first
+    uint8_t port;               ///< Expander output
+    bool    bFourBit;           ///< LCD is in 4 bit mode
+    bool    bHighNibble;        ///< Waiting for the second nibble in 4 bit mode
+    uint8_t nibble;             ///< First nibble received
+    bool    bCGRAM;             ///< Data goes to CGRAM rather than DDRAM
+    bool    bIncrement;         ///< Address increments after each data write
+    uint8_t addr;               ///< Current DDRAM or CGRAM address
+    uint8_t ddram[0x80];        ///< Display memory
+    uint8_t cgram[0x40];        ///< Character generator memory
+    uint8_t displayControl;     ///< Last display control command
+    uint16_t commands;          ///< Number of commands received
+    uint16_t data;              ///< Number of data bytes received
+};
+
+/// Initialise a PCF8574 and HD44780 model.
+///
+/// The display starts filled with spaces in 8 bit mode.
+///
+/// @param[out] pLCD Pointer to the model
+/// @param[in] addr I2C address
+void i2cSimLCDInit( struct sLCDSim *pLCD, uint8_t addr );
+
+#endif //I2C_SIM_H
@@ -0,0 +1,335 @@
+/*
+ * i2c_soft.c
+ *
+ * Bit-banged I2C master on two GPIO pins giving a second bus
+ * which runs alongside the hardware bus in i2c.c.
+ *
+ * The pins are open drain: the output is always low and the
+ * direction register pulls the line low or lets it float high.
+ *
+ * When not compiled for an AVR the pins are those of the simulated
+ * bit-banged bus in i2c_sim.c.
+ *
+ * Created: 17/10/2026
+ * Author : Richard Tomlinson G4TGJ
+ */
+
+#ifdef __AVR__
+#include <avr/io.h>
+#endif
+
+#include "config.h"
+#include "i2c.h"
+#include "i2c_soft.h"
+#include "millis.h"
+
+#ifndef __AVR__
+#include "i2c_sim.h"
+#endif
+
+// Half the clock period
+#ifndef I2C_SOFT_HALF_US
+#define I2C_SOFT_HALF_US 5
+#endif
+
+// Number of half periods to wait for a slave that is stretching the clock
+#ifndef I2C_SOFT_STRETCH_LIMIT
+#define I2C_SOFT_STRETCH_LIMIT 200
+#endif
+
+#ifdef __AVR__
+#define SCL_LOW()       (I2C_SOFT_DDR |= (1<<I2C_SOFT_SCL_BIT))
+#define SCL_FLOAT()     (I2C_SOFT_DDR &= ~(1<<I2C_SOFT_SCL_BIT))
+#define SDA_LOW()       (I2C_SOFT_DDR |= (1<<I2C_SOFT_SDA_BIT))
+#define SDA_RELEASE()   (I2C_SOFT_DDR &= ~(1<<I2C_SOFT_SDA_BIT))
+#define SCL_HIGH()      (I2C_SOFT_PIN & (1<<I2C_SOFT_SCL_BIT))
+#define SDA_HIGH()      (I2C_SOFT_PIN & (1<<I2C_SOFT_SDA_BIT))
+#else
+#define SCL_LOW()       i2cSimSoftDrive( I2C_SIM_SCL, true )
+#define SCL_FLOAT()     i2cSimSoftDrive( I2C_SIM_SCL, false )
+#define SDA_LOW()       i2cSimSoftDrive( I2C_SIM_SDA, true )
+#define SDA_RELEASE()   i2cSimSoftDrive( I2C_SIM_SDA, false )
+#define SCL_HIGH()      i2cSimSoftHigh( I2C_SIM_SCL )
+#define SDA_HIGH()      i2cSimSoftHigh( I2C_SIM_SDA )
+#endif
+
+#define HALF_DELAY()    delayMicroseconds( I2C_SOFT_HALF_US )
+
+// Set when a slave has held SCL low for too long
+static bool bSoftTimeout;
+
+// Release SCL and wait for any clock stretching to end
+static void sclRelease( void )
+{
+    SCL_FLOAT();
+
+    for( uint16_t i = 0 ; !SCL_HIGH() && !bSoftTimeout ; i++ )
+    {
+        if( i == I2C_SOFT_STRETCH_LIMIT )
+        {
+            bSoftTimeout = true;
+        }
+        else
+        {
+            HALF_DELAY();
+        }
+    }
+}
+
+// Send a start or repeated start
+// Returns false if another device is holding SDA low
+static bool softStart( void )
+{
+    SDA_RELEASE();
+    HALF_DELAY();
+    sclRelease();
+    HALF_DELAY();
+
+    if( !SDA_HIGH() || bSoftTimeout )
+    {
+        return false;
+    }
+
+    // SDA falls while SCL is high
+    SDA_LOW();
+    HALF_DELAY();
+    SCL_LOW();
+
+    return true;
+}
+
+// Send a stop
+static void softStop( void )
+{
+    // SDA rises while SCL is high
+    SDA_LOW();
+    HALF_DELAY();
+    sclRelease();
+    HALF_DELAY();
+    SDA_RELEASE();
+    HALF_DELAY();
+}
+
+// Clock a bit out
+static void softWriteBit( bool bBit )
+{
+    if( bBit )
+    {
+        SDA_RELEASE();
+    }
+    else
+    {
+        SDA_LOW();
+    }
+    HALF_DELAY();
+    sclRelease();
+    HALF_DELAY();
+    SCL_LOW();
+}
+
+// Clock a bit in
+static bool softReadBit( void )
+{
+    bool bBit;
+
+    SDA_RELEASE();
+    HALF_DELAY();
+    sclRelease();
+    HALF_DELAY();
+    bBit = SDA_HIGH() != 0;
+    SCL_LOW();
+
+    return bBit;
+}
+
+// Write a byte
+// Returns true if it was acknowledged
+static bool softWriteByte( uint8_t data )
+{
+    for( uint8_t i = 0 ; i < 8 ; i++ )
+    {
+        softWriteBit( data & 0x80 );
+        data <<= 1;
+    }
+
+    // The slave pulls SDA low to acknowledge
+    return !softReadBit() && !bSoftTimeout;
+}
+
+// Read a byte and acknowledge it if more are to follow
+static uint8_t softReadByte( bool bAck )
+{
+    uint8_t data = 0;
+
+    for( uint8_t i = 0 ; i < 8 ; i++ )
+    {
+        data = (data << 1) | softReadBit();
+    }
+
+    softWriteBit( !bAck );
+    SDA_RELEASE();
+
+    return data;
+}
+
+// Recover the bus after a failure.
+// A slave may be holding SDA low part way through a byte so clock it
+// up to 9 times until it lets go and then send a stop.
+// Returns the error code given or the reason the bus is still stuck.
+static uint8_t softRecover( uint8_t result )
+{
+    bSoftTimeout = false;
+    SDA_RELEASE();
+    SCL_FLOAT();
+    HALF_DELAY();
+
+    if( !SCL_HIGH() )
+    {
+        result = I2C_ERROR_SCL_STUCK;
+    }
+    else
+    {
+        for( uint8_t i = 0 ; (i < 9) && !SDA_HIGH() ; i++ )
+        {
+            SCL_LOW();
+            HALF_DELAY();
+            SCL_FLOAT();
+            HALF_DELAY();
+        }
+
+        SCL_LOW();
+        HALF_DELAY();
+        softStop();
+
+        if( !SDA_HIGH() )
+        {
+            result = I2C_ERROR_SDA_STUCK;
+        }
+    }
+
+    bSoftTimeout = false;
+
+    return result;
+}
+
+// Write to the device with an optional register address
+static uint8_t softWriteBlock( uint8_t addr, const uint8_t *pReg, const uint8_t *buf, uint8_t len )
+{
+    uint8_t result = 0;
+
+    if( !softStart() )
+    {
+        result = 1;
+    }
+    else if( !softWriteByte( addr << 1 ) )
+    {
+        result = 2;
+    }
+    else if( pReg && !softWriteByte( *pReg ) )
+    {
+        result = 3;
+    }
+    else
+    {
+        for( uint8_t i = 0 ; i < len ; i++ )
+        {
+            if( !softWriteByte( buf[i] ) )
+            {
+                result = 4;
+                break;
+            }
+        }
+    }
+
+    if( bSoftTimeout )
+    {
+        return softRecover( I2C_ERROR_TIMEOUT );
+    }
+    else if( result == 1 )
+    {
+        return softRecover( result );
+    }
+
+    softStop();
+
+    return result;
+}
+
+void i2cSoftInit( void )
+{
+    // Outputs are always low and the lines float high when released
+#ifdef __AVR__
+    I2C_SOFT_PORT &= ~((1<<I2C_SOFT_SCL_BIT) | (1<<I2C_SOFT_SDA_BIT));
+#endif
+    SDA_RELEASE();
+    SCL_FLOAT();
+}
+
+uint8_t i2cSoftWrite( uint8_t addr, const uint8_t *buf, uint8_t len )
+{
+    return softWriteBlock( addr, 0, buf, len );
+}
+
+uint8_t i2cSoftWriteRegister( uint8_t addr, uint8_t reg, uint8_t data )
+{
+    return softWriteBlock( addr, &reg, &data, 1 );
+}
+
+uint8_t i2cSoftWriteRegisters( uint8_t addr, uint8_t startReg, const uint8_t *buf, uint8_t len )
+{
+    return softWriteBlock( addr, &startReg, buf, len );
+}
+
+uint8_t i2cSoftReadRegisters( uint8_t addr, uint8_t startReg, uint8_t *buf, uint8_t len )
+{
+    uint8_t result = 0;
+
+    if( len == 0 ) return 0;
+
+    if( !softStart() )
+    {
+        result = 1;
+    }
+    else if( !softWriteByte( addr << 1 ) )
+    {
+        result = 2;
+    }
+    else if( !softWriteByte( startReg ) )
+    {
+        result = 3;
+    }
+    else if( !softStart() )
+    {
+        result = 4;
+    }
+    else if( !softWriteByte( (addr << 1) | 1 ) )
+    {
+        result = 5;
+    }
+    else
+    {
+        // NACK the last byte to end the transfer
+        for( uint8_t i = 0 ; i < len ; i++ )
+        {
+            buf[i] = softReadByte( i < (len - 1) );
+        }
+    }
+
+    if( bSoftTimeout )
+    {
+        return softRecover( I2C_ERROR_TIMEOUT );
+    }
+    else if( (result == 1) || (result == 4) )
+    {
+        return softRecover( result );
+    }
+
+    softStop();
+
+    return result;
+}
+
+uint8_t i2cSoftReadRegister( uint8_t addr, uint8_t reg, uint8_t *data )
+{
+    return i2cSoftReadRegisters( addr, reg, data, 1 );
+}
@@ -0,0 +1,78 @@
+/** \file i2c_soft.h
+ *
+ * Bit-banged I2C master on two GPIO pins.
+ *
+ * This is a second bus, independent of the hardware bus in i2c.c,
+ * so slow devices such as an LCD backpack can be kept off the
+ * hardware bus. The pins are set in config.h e.g.
+ *
+ *     #define I2C_SOFT_PORT       PORTB
+ *     #define I2C_SOFT_DDR        DDRB
+ *     #define I2C_SOFT_PIN        PINB
+ *     #define I2C_SOFT_SCL_BIT    0
+ *     #define I2C_SOFT_SDA_BIT    1
+ *
+ * On the tinyAVR 0/1 series use the virtual port registers e.g.
+ * VPORTB.OUT, VPORTB.DIR and VPORTB.IN. The pins are driven open drain
+ * so need pull up resistors. I2C_SOFT_HALF_US sets half the clock
+ * period and defaults to 5us giving a little under 100kHz.
+ *
+ * The functions return the same error codes as those in i2c.h.
+ *
+ * When not compiled for an AVR the pins are those of the simulated
+ * bit-banged bus in i2c_sim.h. test/test_soft.c runs the driver over
+ * it, including a slave holding SDA or SCL low.
+ *
+ * \author Richard Tomlinson G4TGJ
+ */
+
+#ifndef I2C_SOFT_H
+#define I2C_SOFT_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+/// Initialise the software I2C bus.
+///
+/// Must be called before any other software I2C functions.
+void i2cSoftInit( void );
+
+/// Write bytes to a device that has no register address
+/// e.g. a port expander.
+///
+/// @param[in] addr I2C address
+/// @param[in] buf Pointer to the data to write
+/// @param[in] len Number of bytes to write
+uint8_t i2cSoftWrite( uint8_t addr, const uint8_t *buf, uint8_t len );
+
+/// Write to an 8 bit register over the software I2C bus.
+///
+/// @param[in] addr I2C address
+/// @param[in] reg Register address
+/// @param[in] data Data to write to register
+uint8_t i2cSoftWriteRegister( uint8_t addr, uint8_t reg, uint8_t data );
+
+/// Write to a block of consecutive 8 bit registers over the software I2C bus.
+///
+/// @param[in] addr I2C address
+/// @param[in] startReg Address of the first register
+/// @param[in] buf Pointer to the data to write
+/// @param[in] len Number of registers to write
+uint8_t i2cSoftWriteRegisters( uint8_t addr, uint8_t startReg, const uint8_t *buf, uint8_t len );
+
+/// Read from an 8 bit register over the software I2C bus.
+///
+/// @param[in] addr I2C address
+/// @param[in] reg Register address
+/// @param[out] data Pointer to data location to write contents of register to
+uint8_t i2cSoftReadRegister( uint8_t addr, uint8_t reg, uint8_t *data );
+
+/// Read from a block of consecutive 8 bit registers over the software I2C bus.
+///
+/// @param[in] addr I2C address
+/// @param[in] startReg Address of the first register
+/// @param[out] buf Pointer to buffer to receive the register contents
+/// @param[in] len Number of registers to read
+uint8_t i2cSoftReadRegisters( uint8_t addr, uint8_t startReg, uint8_t *buf, uint8_t len );
+
+#endif //I2C_SOFT_H
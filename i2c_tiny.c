@@ -9,20 +9,36 @@
  * Author : Richard Tomlinson G4TGJ
  */ 
  
+#include <avr/interrupt.h>
+
 #include "config.h"
 #include "i2c.h"
 
-#define MAX_ITERATIONS 1000
+#ifndef I2C_ASYNC
 
-static uint8_t i2cStart(uint8_t address, bool bRead )
+// Wait for one of the status flags to set.
+// The deadline is only checked every 256 times round the loop so
+// that the next byte is started as soon as the flag sets.
+static bool i2cWaitStatus( uint8_t mask )
 {
-    int i;
+    uint8_t spin = 0;
 
-    TWI0.MADDR = (address << 1) | bRead;
+    while( !(TWI0.MSTATUS & mask) )
+    {
+        if( (++spin == 0) && i2cTimedOut() )
+        {
+            return false;
+        }
+    }
 
-    for ( i = 0 ; (i < MAX_ITERATIONS) && !(TWI0.MSTATUS & (TWI_WIF_bm | TWI_RIF_bm)) ; i++);
+    return true;
+}
+
+static uint8_t i2cStart(uint8_t address, bool bRead )
+{
+    TWI0.MADDR = (address << 1) | bRead;
 
-    if( i == MAX_ITERATIONS )
+    if( !i2cWaitStatus( TWI_WIF_bm | TWI_RIF_bm ) )
     {
         return false;
     }
@@ -39,92 +55,313 @@ static uint8_t i2cStart(uint8_t address, bool bRead )
 
 static void i2cStop()
 {
-//    int i;
-
     TWI0.MCTRLB = TWI_ACKACT_bm | TWI_MCMD_STOP_gc;
-//	for ( i = 0 ; (i < MAX_ITERATIONS) && (TWCR & (1<<TWSTO)) ; i++);
 }
 
+// Send a byte and wait for it to be acknowledged.
+// The TWI holds SCL low from WIF setting until MDATA is written
+// so the caller has the next byte ready to go.
 static uint8_t i2cByteSend(uint8_t data)
 {
-    int i;
+    TWI0.MDATA = data;
 
-    for ( i = 0 ; ((i < MAX_ITERATIONS) && !(TWI0.MSTATUS & TWI_WIF_bm)) ; i++);
+    return i2cWaitStatus( TWI_WIF_bm ) && !(TWI0.MSTATUS & TWI_RXACK_bm);
+}
 
-    if( i == MAX_ITERATIONS )
+// Write with the register address if pReg is not null
+static uint8_t i2cWriteBlock(uint8_t addr, const uint8_t *pReg, const uint8_t *buf, uint8_t len)
+{
+    uint8_t stts;
+    const uint8_t *end = buf + len;
+    
+    stts = i2cStart(addr, false);
+    if (!stts) return 1;
+
+    if( pReg )
     {
-        return false;
+        stts = i2cByteSend(*pReg);
+        if (!stts)
+        {
+            i2cStop();
+            return 3;
+        }
     }
-    else
+
+    // The device auto-increments the register address after each byte
+    while( buf != end )
     {
-        TWI0.MDATA = data;
-        TWI0.MCTRLB = TWI_MCMD_RECVTRANS_gc;
+        stts = i2cByteSend(*buf++);
+        if (!stts)
+        {
+            i2cStop();
+            return 4;
+        }
+    }
 
-        return !(TWI0.MSTATUS & TWI_RXACK_bm);
+    i2cStop();
+
+    return 0;
+}
+
+static uint8_t i2cReadBlock(uint8_t addr, uint8_t startReg, uint8_t *buf, uint8_t len)
+{
+    uint8_t stts;
+    uint8_t *last = buf + len - 1;
+    
+    stts = i2cStart(addr, false);
+    if (!stts) return 1;
+
+    stts = i2cByteSend(startReg);
+    if (!stts)
+    {
+        i2cStop();
+        return 3;
+    }
+
+    // Smart Mode ACKs each byte as MDATA is read so make sure
+    // the acknowledge action is left as ACK by the last stop
+    TWI0.MCTRLB = 0;
+
+    stts = i2cStart(addr, true);
+    if (!stts)
+    {
+        i2cStop();
+        return 4;
     }
+
+    // Reading MDATA ACKs the byte and starts receiving the next
+    while( buf != last )
+    {
+        if( !i2cWaitStatus( TWI_RIF_bm ) )
+        {
+            i2cStop();
+            return 6;
+        }
+        *buf++ = TWI0.MDATA;
+    }
+
+    if( !i2cWaitStatus( TWI_RIF_bm ) )
+    {
+        i2cStop();
+        return 6;
+    }
+
+    // The stop NACKs the last byte. It is sent before reading MDATA
+    // so that Smart Mode doesn't ACK it.
+    i2cStop();
+    *buf = TWI0.MDATA;
+
+    return 0;
 }
 
-static uint8_t i2cByteRead()
+#else
+
+#define I2C_INTERRUPT_DRIVEN
+
+// The transaction being driven by the interrupt
+static struct sI2CTransaction *pI2CTrans;
+
+// Position in the transaction's buffer
+static uint8_t i2cPos;
+
+// Step of the transaction in progress. These are numbered as the
+// error codes returned by the blocking functions if the step fails.
+static uint8_t i2cStep;
+
+static void i2cTransferStart( struct sI2CTransaction *pTrans )
+{
+    pI2CTrans = pTrans;
+    i2cPos = 0;
+    i2cStep = 1;
+
+    // Wait for the previous stop condition to complete as this may
+    // follow straight on from the last transaction's stop
+    while( ((TWI0.MSTATUS & TWI_BUSSTATE_gm) != TWI_BUSSTATE_IDLE_gc) && !i2cTimedOut() );
+
+    // Writing the address sends the start condition
+    TWI0.MADDR = (pTrans->addr << 1) | 0;
+}
+
+// Send a stop (which also NACKs any last byte read)
+// and finish the transaction
+static void i2cTransferEnd( uint8_t error )
 {
-    int i;
+    TWI0.MCTRLB = TWI_ACKACT_bm | TWI_MCMD_STOP_gc;
 
-    for ( i = 0 ; (i < MAX_ITERATIONS) && !(TWI0.MSTATUS & TWI_RIF_bm) ; i++);
+    i2cTransferComplete( error );
+}
+
+// Move the transaction on to the next step according to the
+// status of the last one
+static void i2cService()
+{
+    uint8_t status = TWI0.MSTATUS;
 
-    if( i == MAX_ITERATIONS )
+    if( status & (TWI_ARBLOST_bm | TWI_BUSERR_bm) )
     {
-        return 0;
+        TWI0.MSTATUS = TWI_ARBLOST_bm | TWI_BUSERR_bm;
+        i2cTransferEnd( i2cStep );
+    }
+    else if( status & TWI_RIF_bm )
+    {
+        if( (i2cPos + 1) < pI2CTrans->len )
+        {
+            // Smart Mode ACKs and receives the next byte as MDATA is read
+            pI2CTrans->buf[i2cPos++] = TWI0.MDATA;
+        }
+        else
+        {
+            // Send the stop first so the last byte is NACKed
+            TWI0.MCTRLB = TWI_ACKACT_bm | TWI_MCMD_STOP_gc;
+            pI2CTrans->buf[i2cPos++] = TWI0.MDATA;
+            i2cTransferComplete( 0 );
+        }
+    }
+    else if( status & TWI_RXACK_bm )
+    {
+        // Address or data not acknowledged
+        i2cTransferEnd( i2cStep );
+    }
+    else if( (i2cStep == 1) && !pI2CTrans->bNoReg )
+    {
+        i2cStep = 3;
+        TWI0.MDATA = pI2CTrans->reg;
+    }
+    else if( (i2cStep == 3) && pI2CTrans->bRead )
+    {
+        // Register address sent so repeated start to read
+        // leaving Smart Mode to ACK the bytes
+        i2cStep = 4;
+        TWI0.MCTRLB = 0;
+        TWI0.MADDR = (pI2CTrans->addr << 1) | 1;
+    }
+    else if( i2cPos < pI2CTrans->len )
+    {
+        i2cStep = 4;
+        TWI0.MDATA = pI2CTrans->buf[i2cPos++];
     }
     else
     {
-        uint8_t data = TWI0.MDATA;
-        TWI0.MCTRLB = TWI_ACKACT_bm | TWI_MCMD_RECVTRANS_gc;
-        return data;
+        i2cTransferEnd( 0 );
     }
 }
 
-uint8_t i2cWriteRegister(uint8_t addr, uint8_t reg, uint8_t data)
+ISR(TWI0_TWIM_vect)
 {
-    uint8_t stts;
-    
-    stts = i2cStart(addr, false);
-    if (!stts) return 1;
+    i2cService();
+}
 
-    stts = i2cByteSend(reg);
-    if (!stts) return 3;
+// Drive the transaction if interrupts are disabled
+static void i2cPoll()
+{
+    if( !(SREG & CPU_I_bm) && (TWI0.MSTATUS & (TWI_WIF_bm | TWI_RIF_bm)) )
+    {
+        i2cService();
+    }
+}
 
-    stts = i2cByteSend(data);
-    if (!stts) return 4;
+#endif
 
-    i2cStop();
+// Fast-mode Plus flag in the clock setting
+#define SETTING_FMP 0x100
 
-    return 0;
+// Work out the MBAUD value for a clock rate.
+// SCL = F_CPU / (10 + 2 * MBAUD)
+// Round up the divider so that the rate never exceeds that requested.
+// Rates above 400kHz need Fast-mode Plus.
+static uint16_t i2cClockSetting( uint32_t hz )
+{
+    uint32_t div = (F_CPU + hz - 1) / hz;
+    uint32_t baud = (div > 10) ? ((div - 10 + 1) / 2) : 0;
+
+    if( baud > 0xFF )
+    {
+        baud = 0xFF;
+    }
+
+    return ((hz > 400000) ? SETTING_FMP : 0) | baud;
 }
 
-uint8_t i2cReadRegister(uint8_t addr, uint8_t reg, uint8_t *data)
+static void i2cApplyClockSetting( uint16_t setting )
 {
-    uint8_t stts;
-    
-    stts = i2cStart(addr, false);
-    if (!stts) return 1;
+    // The baud rate can only be changed while the master is disabled
+    // so wait for any stop condition to complete
+    while( ((TWI0.MSTATUS & TWI_BUSSTATE_gm) == TWI_BUSSTATE_OWNER_gc) && !i2cTimedOut() );
 
-    stts = i2cByteSend(reg);
-    if (!stts) return 3;
+    TWI0.MCTRLA &= ~TWI_ENABLE_bm;
 
-    stts = i2cStart(addr, true);
-    if (!stts) return 4;
+    if( setting & SETTING_FMP )
+    {
+        TWI0.CTRLA |= TWI_FMPEN_bm;
+    }
+    else
+    {
+        TWI0.CTRLA &= ~TWI_FMPEN_bm;
+    }
+    TWI0.MBAUD = setting & 0xFF;
 
-    *data = i2cByteRead();
+    TWI0.MCTRLA |= TWI_ENABLE_bm;
+    TWI0.MSTATUS = TWI_BUSSTATE_IDLE_gc;
+}
 
-    i2cStop();
+// TWI pins used for bus recovery
+// These can be overridden in config.h for alternate pin positions
+#ifndef I2C_GPIO_PORT
+#if defined(__AVR_ATmega808__) || defined(__AVR_ATmega809__) || defined(__AVR_ATmega1608__) || defined(__AVR_ATmega1609__) \
+    || defined(__AVR_ATmega3208__) || defined(__AVR_ATmega3209__) || defined(__AVR_ATmega4808__) || defined(__AVR_ATmega4809__)
+#define I2C_GPIO_PORT   PORTA
+#define I2C_SDA_bm      PIN2_bm
+#define I2C_SCL_bm      PIN3_bm
+#elif defined PORTB
+#define I2C_GPIO_PORT   PORTB
+#define I2C_SDA_bm      PIN1_bm
+#define I2C_SCL_bm      PIN0_bm
+#else
+// 8 pin devices
+#define I2C_GPIO_PORT   PORTA
+#define I2C_SDA_bm      PIN1_bm
+#define I2C_SCL_bm      PIN2_bm
+#endif
+#endif
 
-    return 0;
+// Open drain control of the pins for bus recovery.
+// The output bits are low so setting the direction to output
+// pulls the line low and setting it to input releases it.
+#define I2C_SCL_LOW()       (I2C_GPIO_PORT.DIRSET = I2C_SCL_bm)
+#define I2C_SCL_RELEASE()   (I2C_GPIO_PORT.DIRCLR = I2C_SCL_bm)
+#define I2C_SDA_LOW()       (I2C_GPIO_PORT.DIRSET = I2C_SDA_bm)
+#define I2C_SDA_RELEASE()   (I2C_GPIO_PORT.DIRCLR = I2C_SDA_bm)
+#define I2C_SCL_HIGH()      (I2C_GPIO_PORT.IN & I2C_SCL_bm)
+#define I2C_SDA_HIGH()      (I2C_GPIO_PORT.IN & I2C_SDA_bm)
+
+// Disable the TWI master so the pins can be driven directly
+static void i2cDisable()
+{
+    TWI0.MCTRLA &= ~TWI_ENABLE_bm;
+    I2C_GPIO_PORT.OUTCLR = I2C_SDA_bm | I2C_SCL_bm;
+    I2C_SCL_RELEASE();
+    I2C_SDA_RELEASE();
+}
+
+// Give the pins back to the TWI master and clear any
+// stale flags from the abandoned transaction
+static void i2cEnable()
+{
+    TWI0.MCTRLA |= TWI_ENABLE_bm;
+    TWI0.MSTATUS = TWI_RIF_bm | TWI_WIF_bm | TWI_ARBLOST_bm | TWI_BUSERR_bm | TWI_BUSSTATE_IDLE_gc;
 }
 
 // Init TWI (I2C)
 //
 void i2cInit()
 {
-    TWI0.MBAUD = ((F_CPU / I2C_CLOCK_RATE) - 10 ) / 2;
-    TWI0.MCTRLA = TWI_ENABLE_bm;
+    TWI0.MCTRLA = 0;
+    i2cSetClock( I2C_CLOCK_RATE );
+    // Smart Mode sends the acknowledge as soon as a received byte is read
+#ifdef I2C_ASYNC
+    TWI0.MCTRLA = TWI_ENABLE_bm | TWI_SMEN_bm | TWI_WIEN_bm | TWI_RIEN_bm;
+#else
+    TWI0.MCTRLA = TWI_ENABLE_bm | TWI_SMEN_bm;
+#endif
     TWI0.MSTATUS = TWI_BUSSTATE_IDLE_gc;
-}
+}
\ No newline at end of file
@@ -1,7 +1,9 @@
 #include <stdio.h>
 #include <string.h>
 #include <inttypes.h>
+#ifdef __AVR__
 #include <avr/io.h>
+#endif
 
 #include "config.h"
 #include "lcd.h"
@@ -297,7 +299,7 @@ static void send(uint8_t value, uint8_t mode)
 
 void lcdPrint( const char *string )
 {
-    for( int i = 0 ; i < strlen(string) ; i++ )
+    for( size_t i = 0 ; i < strlen(string) ; i++ )
     {
         lcd_write(string[i]);
     }
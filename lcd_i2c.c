@@ -12,6 +12,10 @@
 #include "i2c.h"
 #include "millis.h"
 
+#ifdef LCD_I2C_SOFT
+#include "i2c_soft.h"
+#endif
+
 // flags for backlight control
 #define LCD_BACKLIGHT 0x08
 #define LCD_NOBACKLIGHT 0x00
@@ -32,22 +36,49 @@
 #define BACKLIGHT_STATE LCD_BACKLIGHT
 #endif
 
-static uint8_t regVal = BACKLIGHT_STATE;
+// Keep track of the current expander value in the I2C cache
+static uint8_t regVal, regValid[I2C_CACHE_VALID_LEN(1)];
+#ifndef LCD_I2C_SOFT
+static struct sI2CCache lcdCache = { LCD_I2C_ADDRESS, 0, 1, true, &regVal, regValid, 0 };
+#endif
+
+// Write to the I2C expander
+static void lcdI2CWrite( uint8_t value )
+{
+#ifdef LCD_I2C_SOFT
+    // On the software bus only send the value if it has changed
+    if( (value != regVal) || !regValid[0] )
+    {
+        regVal = value;
+        regValid[0] = (i2cSoftWrite( LCD_I2C_ADDRESS, &value, 1 ) == 0);
+    }
+#else
+    // The cache only sends the value if it has changed
+    i2cCacheWriteRegister( LCD_I2C_ADDRESS, 0, value );
+#endif
+}
 
 // Initialise the LCD interface i.e. the I2C interface
 void lcdIFInit()
 {
+#ifdef LCD_I2C_SOFT
+    // The display has a bus of its own
+    i2cSoftInit();
+#else
     i2cInit();
-}
+    i2cCacheAdd( &lcdCache );
 
-// Write to the I2C expander
-static void lcdI2CWrite( uint8_t value )
-{
-    // We use the pre-existing I2C send register function which actually sends the
-    // data twice (this simple device has no register addresses)
-    i2cWriteRegister( LCD_I2C_ADDRESS, value, value );
+    // Backpacks are often slower than other devices on the bus
+#ifdef LCD_I2C_CLOCK_RATE
+    i2cSetDeviceClock( LCD_I2C_ADDRESS, LCD_I2C_CLOCK_RATE );
+#endif
+
+    // Don't hold up time critical devices on the same bus
+    i2cSetDevicePriority( LCD_I2C_ADDRESS, I2C_PRIORITY_LOW );
+#endif
 
-    regVal = value;
+    // Set the initial expander state so the cache holds a known value
+    lcdI2CWrite( BACKLIGHT_STATE );
 }
 
 // Write to the LCD's data bits
@@ -7,8 +7,10 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <util/atomic.h>
+#include <stdbool.h>
  
 #include "config.h"
+#include "millis.h"
 
 // Calculate the value needed for
 // the CTC match value in OCR1A.
@@ -70,13 +72,25 @@
 // Calculate the number of ticks for one millisecond
 #define CTC_MATCH_OVERFLOW (F_CPU / CLOCK_DIV / 1000)
 
+// Scale factor to convert timer counts to microseconds.
+// Multiply by this and divide by 65536.
+#define MICROS_SCALE ((65536000UL + CTC_MATCH_OVERFLOW/2) / CTC_MATCH_OVERFLOW)
+
 volatile uint32_t timer1_ticks;
+
+// Called at each tick if set
+static void (* volatile tickCallback)( void );
  
 #if defined TCA0
 ISR(TCA0_OVF_vect)
 {
     timer1_ticks++;
 
+    if( tickCallback )
+    {
+        tickCallback();
+    }
+
     /* The interrupt flag has to be cleared manually */
     TCA0.SINGLE.INTFLAGS = TCA_SINGLE_OVF_bm;
 }
@@ -88,6 +102,11 @@ ISR (TIM1_COMPA_vect)
 #endif
 {
     timer1_ticks++;
+
+    if( tickCallback )
+    {
+        tickCallback();
+    }
 }
 #endif
 
@@ -104,6 +123,40 @@ uint32_t millis ()
     return ticks;
 }
 
+// Return the current microsecond count
+// This is built from the millisecond tick count and the timer count
+uint32_t micros ()
+{
+    uint32_t ticks;
+    uint16_t count;
+    bool bPending;
+
+    // Ensure this cannot be disrupted but allow it to be called
+    // from an interrupt handler
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        ticks = timer1_ticks;
+#if defined TCA0
+        count = TCA0.SINGLE.CNT;
+        bPending = TCA0.SINGLE.INTFLAGS & TCA_SINGLE_OVF_bm;
+#elif defined OCR1AH
+        count = TCNT1;
+        bPending = TIFR1 & (1 << OCF1A);
+#else
+        count = TCNT1;
+        bPending = TIFR & (1 << OCF1A);
+#endif
+    }
+
+    // If the timer has wrapped but the interrupt hasn't been serviced
+    // yet then the tick count is one behind
+    if( bPending && (count < CTC_MATCH_OVERFLOW/2) )
+    {
+        ticks++;
+    }
+
+    return ticks * 1000 + (((uint32_t) count * MICROS_SCALE) >> 16);
+}
+
 // Delay for a number of milliseconds
 // This is a busy wait so use with care
 void delay( uint16_t ms )
@@ -112,6 +165,14 @@ void delay( uint16_t ms )
     for( ; millis() < endTime ; );
 }
 
+// Set the function called at each tick
+void millisSetTickCallback( void (*callback)( void ) )
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        tickCallback = callback;
+    }
+}
+
 // Initialise the timer
 void millisInit(void)
 {
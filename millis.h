@@ -13,9 +13,24 @@
 /// @return Number of milliseconds
 uint32_t millis();
 
+/// Return the number of microseconds since the box started.
+/// Wraps after approx 71 minutes. Can be called from an
+/// interrupt handler.
+/// 
+/// @return Number of microseconds
+uint32_t micros();
+
 /// Initialise the millisecond timer.
 void millisInit(void);
 
+/// Set a function to be called from the millisecond timer interrupt.
+///
+/// It is called once a millisecond with interrupts disabled so must
+/// be short. Only one function can be set.
+///
+/// @param[in] callback Function to call or 0 for none
+void millisSetTickCallback( void (*callback)( void ) );
+
 /// Delay a number of milliseconds.
 /// 
 /// @param[in] ms Number of milliseconds to wait
@@ -24,6 +39,10 @@ void delay( uint16_t ms );
 /// Delay a number of microseconds.
 /// 
 /// @param[in] us Number of microseconds to wait
+#ifdef __AVR__
 #define delayMicroseconds( us ) __builtin_avr_delay_cycles( F_CPU / 1000000 * us )
+#else
+void delayMicroseconds( uint32_t us );
+#endif
 
 #endif /* MILLIS_H_ */
\ No newline at end of file
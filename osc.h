@@ -1,4 +1,15 @@
 /** \file osc.h
+ *
+ * Si5351A clock generator.
+ *
+ * Each chip is described by a struct sOscDevice which holds its I2C
+ * address and all the state the driver keeps for it, so one firmware
+ * can drive several chips. The oscDev functions take the device as
+ * their first argument. When SI5351A_I2C_ADDRESS is defined in config.h
+ * the functions without the Dev prefix drive a default device at that
+ * address.
+ *
+ * Code that allocates a device also needs osc_device.h.
  *
  *  \date 16/09/2019
  *  \author Richard Tomlinson G4TGJ
@@ -8,13 +19,137 @@
 #define OSC_H
 
 #include <inttypes.h>
+#include <stdbool.h>
+
+/// State kept for one Si5351A, defined in osc_device.h.
+struct sOscDevice;
+
+/// A clock frequency for oscSetFrequencies().
+struct sOscRequest
+{
+    uint8_t  clock;         ///< Clock output to set
+    uint32_t frequency;     ///< Frequency in hertz
+    int8_t   q;             ///< Quadrature mode as for oscSetFrequency()
+};
+
+/// Initialise a chip.
+///
+/// The crystal frequency may be set before or after. The I2C driver
+/// isn't started here so that several chips can share the bus. Call
+/// i2cInit() once first, then i2cSetClock() if needed. The millisecond
+/// timer must be running as the wait for the chip to come out of its
+/// system initialisation times out after OSC_INIT_TIMEOUT_US (default
+/// 100ms). If it isn't the wait ends after OSC_INIT_TIMEOUT_US /
+/// OSC_INIT_READ_US (default 10) status reads instead.
+///
+/// @param[in] pDev Pointer to the device
+/// @param[in] addr I2C address
+/// @returns true if successful
+/// @returns false if unable to talk to it or it doesn't initialise properly
+bool oscDevInit( struct sOscDevice *pDev, uint8_t addr );
+
+/// Marks the end of a register image for oscLoadImage().
+#define OSC_IMAGE_END   0xFF
+
+/// oscLoadImage() for a chip.
+///
+/// Use this in place of oscDevInit(). The I2C driver must have been
+/// started in the same way.
+///
+/// @param[in] pDev Pointer to the device
+/// @param[in] addr I2C address
+/// @param[in] pImage Register image in program memory
+/// @returns true if successful
+/// @returns false if unable to talk to the chip or a write failed
+bool oscDevLoadImage( struct sOscDevice *pDev, uint8_t addr, const uint8_t *pImage );
+
+/// Set the crystal frequency of a chip.
+///
+/// @param[in] pDev Pointer to the device
+/// @param[in] xtal_freq Crystal frequency (in hertz)
+void oscDevSetXtalFrequency( struct sOscDevice *pDev, uint32_t xtal_freq );
+
+/// oscSetFrequency() for a chip.
+void oscDevSetFrequency( struct sOscDevice *pDev, uint8_t clock, uint32_t frequency, int8_t q );
+
+/// oscSetFrequencyMilliHz() for a chip.
+uint64_t oscDevSetFrequencyMilliHz( struct sOscDevice *pDev, uint8_t clock, uint64_t frequency, int8_t q );
+
+/// oscSetFrequencies() for a chip.
+void oscDevSetFrequencies( struct sOscDevice *pDev, const struct sOscRequest *pReqs, uint8_t n );
+
+/// oscSetFrequencyAsync() for a chip.
+void oscDevSetFrequencyAsync( struct sOscDevice *pDev, uint8_t clock, uint32_t frequency, int8_t q );
+
+/// oscPoll() for a chip.
+///
+/// Call this for each chip each time round the main loop.
+bool oscDevPoll( struct sOscDevice *pDev );
+
+/// oscClockEnable() for a chip.
+void oscDevClockEnable( struct sOscDevice *pDev, uint8_t clock, bool bEnable );
+
+/// oscFskInit() for a chip.
+///
+/// There is one FSK engine which sends on the chip last given here.
+bool oscDevFskInit( struct sOscDevice *pDev, uint8_t clock, uint64_t frequency, uint32_t spacing, uint8_t numTones );
+
+/// oscSweepStart() for a chip.
+///
+/// There is one sweep which runs on the chip last given here.
+bool oscDevSweepStart( struct sOscDevice *pDev, uint8_t clock, uint32_t fStart, int32_t fStep, uint16_t nSteps );
 
 /// Initialise the oscillator.
 ///
+/// This starts the I2C driver with i2cInit() so set the bus clock
+/// rate with i2cSetClock() afterwards.
+///
 /// @returns true if successful
 /// @returns false if unable to talk to it or it doesn't initialise properly
 bool oscInit( void );
 
+/// Initialise the oscillator from a register image.
+///
+/// For fixed frequencies from a register map e.g. one exported by
+/// ClockBuilder. Use this in place of oscInit(). The image is held in
+/// program memory (PROGMEM) as register address and value pairs ending
+/// with OSC_IMAGE_END e.g.
+///
+///     static const uint8_t image[] PROGMEM =
+///     {
+///         15, 0x00,
+///         16, 0x4F,
+///         ...
+///         OSC_IMAGE_END
+///     };
+///
+/// Following figure 12 of the data sheet, the outputs are disabled and
+/// powered down, the registers written, both PLLs reset and then the
+/// outputs enabled as given by register 3 in the image (all of them if
+/// it isn't there). The outputs powered down are the NUM_CLOCKS this
+/// driver uses and any others up to CLK7 that register 3 enables. Any
+/// PLL reset register in the image is ignored. Consecutive registers are
+/// sent in bursts of up to OSC_LOAD_BURST (default 32) so list them in
+/// address order.
+///
+/// Every register in the image is sent as the chip may not be at its
+/// power on defaults. This does not start the clocks within 1ms for a
+/// full ClockBuilder map: its 100 or so registers take about 130 bytes
+/// on the bus, which is 3ms at 400kHz or 1.2ms at 1MHz, and the PLL
+/// reset waits a further 1ms after them. Leaving out the registers the
+/// board doesn't need to set shortens the bus time but not the wait.
+///
+/// Like oscInit() this starts the I2C driver with i2cInit().
+///
+/// The driver doesn't know the frequencies loaded. To change clocks
+/// afterwards set all those in use e.g. with oscSetFrequencies() as
+/// clocks sharing a PLL move together.
+///
+/// @param[in] pImage Register image in program memory
+/// @returns true if successful
+/// @returns false if unable to talk to the chip or a write failed
+bool oscLoadImage( const uint8_t *pImage );
+
 /// Set the clock to the given frequency with optional quadrature.
 //
 /// quadrature is only used for clock 1 - it is ignored for the others.
@@ -31,6 +166,168 @@ bool oscInit( void );
 /// @param[in] q Quadrature mode
 void oscSetFrequency( uint8_t clock, uint32_t frequency, int8_t q );
 
+/// Set the clock to a frequency with millihertz resolution.
+///
+/// The usual dividers only give a resolution of about 1Hz. Here the
+/// fractional parts of the dividers are the closest fractions, with
+/// denominators up to 1048575, found by continued fractions. This takes
+/// a bounded time so can be used for each symbol of e.g. WSPR or FT8.
+///
+/// Only the clock being set gets the extra resolution. Where clocks 0
+/// and 1 share PLL A the other clock keeps its own resolution.
+///
+/// @param[in] clock Clock output to set
+/// @param[in] frequency Frequency in millihertz
+/// @param[in] q Quadrature mode as for oscSetFrequency()
+/// @return Frequency achieved in millihertz or 0 if the clock is invalid
+///         or has been powered down as it can't be set
+uint64_t oscSetFrequencyMilliHz( uint8_t clock, uint64_t frequency, int8_t q );
+
+/// Set several clocks at once.
+///
+/// All the outputs are planned together so each PLL is worked out once,
+/// the changed registers are written in one pass and there is at most
+/// one PLL reset covering both PLLs. Use this rather than several calls
+/// to oscSetFrequency() when changing band.
+///
+/// Invalid clocks are ignored. If a clock appears more than once the
+/// last request wins.
+///
+/// Normally clocks 0 and 1 use PLL A and clock 2 uses PLL B. With
+/// OSC_PLANNER defined in config.h the PLLs are shared out again when
+/// a clock is set. Setting one clock only tries the ways where it sets
+/// one of the PLLs unless those leave a clock that can't be set, when
+/// every way of sharing them out is tried. One clock on each PLL sets it with an even
+/// integer divider. The others go where they get an integer divider if
+/// possible to keep the jitter low. Clocks set to the millihertz are
+/// preferred for setting a PLL as that keeps them exact. Running clocks
+/// are only moved or have their PLL reset if that gains more than the
+/// glitch costs. OSC_PLANNER also allows NUM_CLOCKS up to 8 for the
+/// parts with more outputs, where clocks 6 and 7 only take even integer
+/// dividers from 6 to 254. If neither PLL gives one of those they are
+/// powered down until set again.
+///
+/// @param[in] pReqs Pointer to the requests
+/// @param[in] n Number of requests
+void oscSetFrequencies( const struct sOscRequest *pReqs, uint8_t n );
+
+/// @name FSK
+/// Multi-tone FSK for digital modes such as WSPR and FT8.
+///
+/// Only available when OSC_FSK is defined. The PLL register values for
+/// each tone are worked out once by oscFskInit() with a common denominator
+/// so only P1 and P2 differ between the tones. oscFskStart() sets a
+/// millisecond tick callback with millisSetTickCallback() which writes
+/// just the PLL registers that differ at the start of each symbol. This
+/// is usually the last three.
+///
+/// With I2C_ASYNC the write is queued from the interrupt at high priority
+/// so each symbol starts within the bus time of the tick. Otherwise the
+/// interrupt only marks the tone as due and oscPoll() writes it, so each
+/// symbol starts late by up to the time between calls to oscPoll() from
+/// the main loop. The symbols are timed from the tick so the lateness
+/// does not build up but it is jitter on each symbol edge. Use I2C_ASYNC
+/// where that matters.
+///
+/// The clock must not be changed while the symbols are being sent. The
+/// tones are made by moving the PLL so where clocks 0 and 1 share PLL A
+/// the other clock moves too.
+/// @{
+
+/// Work out the tones and set the clock to the first.
+///
+/// Tone n is frequency + n * spacing. The tones should span
+/// less than 1kHz. The spacing is kept exact but with the common
+/// denominator the first tone can be up to half a step of the PLL
+/// numerator away from frequency e.g. 0.2Hz at 14MHz. This is far
+/// less than the error in the crystal frequency.
+///
+/// @param[in] clock Clock output to use
+/// @param[in] frequency Frequency of tone 0 in millihertz
+/// @param[in] spacing Spacing of the tones in millihertz
+/// @param[in] numTones Number of tones up to OSC_FSK_MAX_TONES (default 8)
+/// @returns true if successful
+/// @returns false if the parameters are invalid or symbols are being sent
+bool oscFskInit( uint8_t clock, uint64_t frequency, uint32_t spacing, uint8_t numTones );
+
+/// Start sending symbols.
+///
+/// The first symbol starts straight away. The symbol period is
+/// periodNum / periodDen milliseconds e.g. 8192 / 12 for WSPR and 160 / 1
+/// for FT8. Fractions of a millisecond are carried from one symbol to the
+/// next so there is no drift. The millisecond tick callback is used until
+/// the last symbol has been sent.
+///
+/// @param[in] pSymbols Tone for each symbol. Must remain valid until sent.
+/// @param[in] numSymbols Number of symbols
+/// @param[in] periodNum Numerator of the symbol period
+/// @param[in] periodDen Denominator of the symbol period
+/// @returns true if started
+/// @returns false if oscFskInit() hasn't been called or symbols are already being sent
+bool oscFskStart( const uint8_t *pSymbols, uint16_t numSymbols, uint16_t periodNum, uint16_t periodDen );
+
+/// Stop sending symbols.
+///
+/// The clock stays on the last tone sent.
+void oscFskStop( void );
+
+/// Find out if symbols are being sent.
+///
+/// @returns true until the last symbol period has finished
+bool oscFskBusy( void );
+
+/// @}
+
+/// @name Sweep
+/// Stepped frequency sweep e.g. for an antenna analyser.
+///
+/// Only available when OSC_SWEEP is defined. The multisynth and R dividers
+/// are fixed for the whole sweep so each step only rewrites the PLL
+/// registers that have changed, without a PLL reset or a settle delay.
+/// A sweep too wide for one divider to keep the VCO in the 600-900MHz
+/// range is split into parts and the PLL is reset between them.
+/// Where clocks 0 and 1 share PLL A the other clock moves too.
+/// @{
+
+/// Start a sweep.
+///
+/// The clock is set to the start frequency.
+///
+/// @param[in] clock Clock output to sweep
+/// @param[in] fStart Start frequency in hertz
+/// @param[in] fStep Step in hertz which may be negative
+/// @param[in] nSteps Number of steps after the start frequency
+/// @returns true if successful
+/// @returns false if the clock is invalid or the sweep goes out of range
+bool oscSweepStart( uint8_t clock, uint32_t fStart, int32_t fStep, uint16_t nSteps );
+
+/// Move a sweep on by one step.
+///
+/// @returns true if the clock has moved to the next frequency
+/// @returns false if the sweep has finished
+bool oscSweepNext( void );
+/// @}
+
+/// Start setting the clock to the given frequency without waiting.
+///
+/// The PLL and multisynth registers are written straight away. Switching
+/// on the output and any PLL reset are left until the multisynths have
+/// settled (OSC_SETTLE_US, default 1ms) and are done by oscPoll().
+/// Further changes made before then are merged into one settle.
+///
+/// @param[in] clock Clock output to set
+/// @param[in] frequency Frequency in hertz
+/// @param[in] q Quadrature mode as for oscSetFrequency()
+void oscSetFrequencyAsync( uint8_t clock, uint32_t frequency, int8_t q );
+
+/// Finish a frequency change started by oscSetFrequencyAsync().
+///
+/// Call this each time round the main loop.
+///
+/// @returns true if a frequency change is still in progress
+/// @returns false if the oscillator is idle
+bool oscPoll( void );
+
 /// Enable/disable a clock output.
 ///
 /// @param[in] clock Clock output to control
@@ -0,0 +1,86 @@
+/** \file osc_device.h
+ *
+ * Per-chip state of the Si5351A driver.
+ *
+ * Include this where a struct sOscDevice is allocated. The size of the
+ * device depends on NUM_CLOCKS and OSC_PLANNER so config.h must be
+ * included first. Code that only passes pointers to a device needs just
+ * osc.h.
+ *
+ * \author Richard Tomlinson G4TGJ
+ */
+
+#ifndef OSC_DEVICE_H
+#define OSC_DEVICE_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "i2c.h"
+#include "osc.h"
+
+#ifndef NUM_CLOCKS
+#error "Include config.h before osc_device.h"
+#endif
+
+/// Number of PLL and multisynth registers from PLL A up to the last clock.
+#if NUM_CLOCKS > 6
+#define OSC_SYNTH_REGS  67
+#else
+#define OSC_SYNTH_REGS  (16 + 8*NUM_CLOCKS)
+#endif
+
+/// State kept for one Si5351A.
+///
+/// This belongs to the caller and is set up by oscDevInit(). It must
+/// start zeroed e.g. by being a global or static and remain valid for
+/// as long as the chip is used. With 3 clocks it takes about 155 bytes.
+struct sOscDevice
+{
+    uint8_t  addr;                          ///< I2C address
+    uint32_t xtalFreq;                      ///< Crystal frequency in hertz
+    uint32_t pllDenom;                      ///< PLL denominator for 1Hz resolution
+    uint32_t clockFreq[NUM_CLOCKS];         ///< Clock frequencies after the R dividers
+    uint16_t clockMilliHz[NUM_CLOCKS];      ///< Fractions of a hertz from oscDevSetFrequencyMilliHz()
+    bool     clockExact[NUM_CLOCKS];        ///< Clock uses the closest fractions
+    uint8_t  rDiv[NUM_CLOCKS];              ///< R dividers
+    uint16_t prevDivider[NUM_CLOCKS];       ///< Multisynth divider at the last PLL reset
+    uint16_t pllDivider[2];                 ///< Multisynth divider last used on each PLL
+    int8_t   quadrature;                    ///< Quadrature mode of clock 1
+    int8_t   prevQuadrature;                ///< Quadrature mode at the last PLL reset
+#ifdef OSC_PLANNER
+    uint8_t  clockPLL[NUM_CLOCKS];          ///< PLL each clock has been given
+    uint8_t  planClocks;                    ///< Clocks placed on the PLLs by the last plan
+    uint8_t  planMaster[2];                 ///< Clocks that set the PLLs in the last plan
+#endif
+
+    /// Register writes waiting for the multisynths to settle
+    struct
+    {
+        bool     bPending;                  ///< There are writes waiting
+        uint32_t first;                     ///< micros() time of the first change waiting
+        uint32_t deadline;                  ///< micros() time when they can be done
+        uint8_t  clocks;                    ///< Bit set for each clock to switch on
+        bool     bPhoff;                    ///< Phase offsets need writing
+        uint8_t  phoff[2];                  ///< Phase offsets for clocks 0 and 1
+        uint8_t  pllReset;                  ///< PLLs to reset
+    } settle;
+
+    /// @name Shadow copies of the registers written
+    /// @{
+    uint8_t  shadowEnable[1];
+    uint8_t  validEnable[I2C_CACHE_VALID_LEN(1)];
+    uint8_t  shadowControl[NUM_CLOCKS];
+    uint8_t  validControl[I2C_CACHE_VALID_LEN(NUM_CLOCKS)];
+    uint8_t  shadowSynth[OSC_SYNTH_REGS];
+    uint8_t  validSynth[I2C_CACHE_VALID_LEN(OSC_SYNTH_REGS)];
+    uint8_t  shadowPhoff[2];
+    uint8_t  validPhoff[I2C_CACHE_VALID_LEN(2)];
+    struct sI2CCache cacheEnable;
+    struct sI2CCache cacheControl;
+    struct sI2CCache cacheSynth;
+    struct sI2CCache cachePhoff;
+    /// @}
+};
+
+#endif //OSC_DEVICE_H
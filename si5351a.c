@@ -11,10 +11,21 @@
 //
 #include <inttypes.h>
 #include <stdio.h>
+#include <string.h>
+
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#else
+#define PROGMEM
+#define pgm_read_byte(p)    (*(p))
+#define pgm_read_word(p)    (*(p))
+#define pgm_read_dword(p)   (*(p))
+#endif
 
 #include "config.h"
 #include "i2c.h"
 #include "osc.h"
+#include "osc_device.h"
 #include "millis.h"
 
 // Register definitions
@@ -33,6 +44,9 @@
 #define SI_SYNTH_MS_0	42
 #define SI_SYNTH_MS_1	50
 #define SI_SYNTH_MS_2	58
+#define SI_SYNTH_MS_6	90
+#define SI_SYNTH_MS_7	91
+#define SI_SYNTH_R_DIV_67	92
 #define SI_CLK0_PHOFF   165
 #define SI_CLK1_PHOFF   166
 
@@ -61,8 +75,18 @@
 #define SI_CLK_SRC_PLL_A	0b00000000
 #define SI_CLK_SRC_PLL_B	0b00100000
 
-// Maximum number of times to poll for the system init bit clearing
-#define MAX_INIT_TRIES 10000
+// Time in microseconds to wait for the system init bit to clear
+#ifndef OSC_INIT_TIMEOUT_US
+#define OSC_INIT_TIMEOUT_US 100000UL
+#endif
+
+// Fewest microseconds a status read can take, which is the address
+// byte alone not acknowledged at 1MHz. The limit on the number of
+// reads, used in case micros() isn't advancing, is never reached
+// before the deadline.
+#ifndef OSC_INIT_READ_US
+#define OSC_INIT_READ_US 10
+#endif
 
 // Enum for the two PLLs along with a mapping to the actual registers
 enum eSynthPLL
@@ -73,17 +97,134 @@ enum eSynthPLL
 };
 const uint8_t synthPLL[NUM_SYNTH_PLL] = { SI_SYNTH_PLL_A, SI_SYNTH_PLL_B };
 
-// Record the clock and PLL frequencies
-static uint32_t pllFreq[NUM_SYNTH_PLL];
-static uint32_t clockFreq[NUM_CLOCKS];
+// Each device keeps shadow copies of the registers we write so that
+// unchanged values are not sent again. This minimises noise from the I2C bus.
+// Clocks 6 and 7 of the 8 output parts only have an 8 bit integer
+// multisynth register each and share a register for their R dividers.
+#if NUM_CLOCKS > 8
+#error "The Si5351 has at most 8 clocks"
+#elif (NUM_CLOCKS > 3) && !defined(OSC_PLANNER)
+#error "More than 3 clocks needs OSC_PLANNER to share out the PLLs"
+#elif NUM_CLOCKS > 6
+#define NUM_SYNTH_REGS  (SI_SYNTH_R_DIV_67 + 1 - SI_SYNTH_PLL_A)
+#else
+#define NUM_SYNTH_REGS  (SI_SYNTH_MS_0 + 8*NUM_CLOCKS - SI_SYNTH_PLL_A)
+#endif
+
+// Clocks 0 and 1 share PLL A when there are two or more
+#if NUM_CLOCKS > 1
+#define NUM_PLL_A_CLOCKS    2
+#else
+#define NUM_PLL_A_CLOCKS    1
+#endif
+
+#if NUM_SYNTH_REGS != OSC_SYNTH_REGS
+#error "OSC_SYNTH_REGS in osc.h doesn't match the register map"
+#endif
+
+// Clocks from this one up only have integer multisynths
+// with an even divider up to 254
+#define FIRST_INTEGER_CLOCK 6
+#define MAX_INTEGER_DIVIDER 254
+#define NUM_PHOFF_REGS  2
+
+// The PLL that a clock uses
+static uint8_t oscClockPLL( struct sOscDevice *pDev, uint8_t clock )
+{
+#ifdef OSC_PLANNER
+    return pDev->clockPLL[clock];
+#else
+    (void) pDev;
+    return (clock == 2) ? SYNTH_PLL_B : SYNTH_PLL_A;
+#endif
+}
+
+// We will set the PLL denominator as the crystal frequency divided by 27 as we
+// want it to be about a million so it is as large as possible for greatest resolution.
+// (The maximum denominator is 1048575.)
+// This sets a maximum crystal of over 28MHz (crystal should be 25MHz or 27MHz)
+// This allows us to use 32 bit integers.
+// The error in the resulting frequency will be less than 1Hz
+// It only changes with the crystal so is worked out in oscSetXtalFrequency()
+#define DENOM_RATIO 27
+
+// Number of registers for each PLL and multisynth
+#define NUM_PLL_BYTES 8
+#define NUM_MS_BYTES  8
+
+// The AVR has no divide instruction and the library 32 bit division
+// takes 32 shift and subtract steps. The quotients here are mostly
+// small so these avoid the library division.
+
+// Divide n by d where the quotient is known to fit in the given number of bits
+// (1 to 31) i.e. (n >> bits) < d. Only that many shift and subtract steps are needed.
+// d must be below 2^31.
+// Returns the quotient with the remainder in *pRem.
+static uint32_t divSmall( uint32_t n, uint32_t d, uint8_t bits, uint32_t *pRem )
+{
+    uint32_t rem = n >> bits;
+    uint32_t low = n << (32 - bits);
+    uint32_t q = 0;
+
+    for( uint8_t i = 0 ; i < bits ; i++ )
+    {
+        // Bring down the next bit of n
+        rem = (rem << 1) | (low >> 31);
+        low <<= 1;
+
+        q <<= 1;
+        if( rem >= d )
+        {
+            rem -= d;
+            q |= 1;
+        }
+    }
+
+    *pRem = rem;
+    return q;
+}
+
+// The same for 64 bit values (bits 1 to 63) as used by the millihertz
+// tuning. d must be below 2^63.
+static uint64_t divSmall64( uint64_t n, uint64_t d, uint8_t bits, uint64_t *pRem )
+{
+    uint64_t rem = n >> bits;
+    uint64_t low = n << (64 - bits);
+    uint64_t q = 0;
+
+    for( uint8_t i = 0 ; i < bits ; i++ )
+    {
+        rem = (rem << 1) | (low >> 63);
+        low <<= 1;
+
+        q <<= 1;
+        if( rem >= d )
+        {
+            rem -= d;
+            q |= 1;
+        }
+    }
+
+    *pRem = rem;
+    return q;
+}
+
+// Work out the AN619 register values P1 and P2 for a divider of a+b/c
+// (P3 is just c). b must not be more than c.
+static void calcP1P2( uint32_t a, uint32_t b, uint32_t c, uint32_t *pP1, uint32_t *pP2 )
+{
+    // p = 128 * b / c is at most 128 so fits in 8 bits and
+    // P2 = 128 * b - c * p is the remainder
+    uint32_t p = divSmall( 128 * b, c, 8, pP2 );
 
-// The crystal frequency which is initialised from NVRAM
-static uint32_t xtalFreq;
+    *pP1 = 128 * a + p - 512;
+}
 
 //
-// Set up specified PLL with the specified divider and frequency
+// Work out the register values for a PLL with the specified divider and frequency
+// Returns the PLL frequency
 //
-static void setupPLL(uint8_t pll, uint32_t divider, uint32_t frequency)
+static uint32_t calcPLL(struct sOscDevice *pDev, uint32_t divider, uint32_t frequency, uint8_t *regs)
 {
     // a, b and c as defined in AN619
     uint32_t a, b, c;
@@ -93,74 +234,71 @@ static void setupPLL(uint8_t pll, uint32_t divider, uint32_t frequency)
     uint32_t P2;
     uint32_t P3;
 
-    // We are only going to send bytes that have changed to minimise noise
-    // from the I2C bus.
-    #define NUM_PLL_BYTES 8
-    static uint8_t prevPll[NUM_SYNTH_PLL][NUM_PLL_BYTES];
-    uint8_t newPll[NUM_SYNTH_PLL][NUM_PLL_BYTES];
+    // The PLL frequency
+    uint32_t pllFreq;
+
+    // Remainder of the PLL frequency divided by the crystal frequency
+    uint32_t r;
+
+    // The denominator set in oscSetXtalFrequency()
+    c = pDev->pllDenom;
+
+    // Calculate the pllFrequency: the divider * desired output frequency
+    pllFreq = divider * frequency;
+
+    // Determine the multiplier to get to the required pllFrequency
+    // Integer part is easy. It is under 256 for crystals over 17MHz.
+    a = divSmall( pllFreq, pDev->xtalFreq, 8, &r );
+
+    // Work out the fractional part (b/c)
+    // c is the denominator set above
+    // Can easily get b because we set c as a fraction of xtalFreq
+    // b = (pllFreq % xtalFreq) * c / xtalFreq
+    // but c is xtalFreq/27 so we get b = r / 27 which is under 2^21
+    b = divSmall( r, DENOM_RATIO, 21, &r );
 
+    // Calculate the values as defined in AN619
+    calcP1P2( a, b, c, &P1, &P2 );
+    P3 = c;
+    
+    // Work out the new register values
+    regs[0] = (P3 & 0x0000FF00) >> 8;
+    regs[1] = (P3 & 0x000000FF);
+    regs[2] = (P1 & 0x00030000) >> 16;
+    regs[3] = (P1 & 0x0000FF00) >> 8;
+    regs[4] = (P1 & 0x000000FF);
+    regs[5] = ((P3 & 0x000F0000) >> 12) | ((P2 & 0x000F0000) >> 16);
+    regs[6] = (P2 & 0x0000FF00) >> 8;
+    regs[7] = (P2 & 0x000000FF);
+
+    return pllFreq;
+}
+
+// The planner writes the PLLs and multisynths in one block
+// so these are only needed for the sweep
+#if !defined(OSC_PLANNER) || defined(OSC_SWEEP)
+//
+// Set up specified PLL with the calculated register values
+//
+static void setupPLL(struct sOscDevice *pDev, uint8_t pll, const uint8_t *regs)
+{
     // Ensure PLL is within range
     if( pll < NUM_SYNTH_PLL )
     {
-        // We will set the denominator as the crystal frequency divided by 27 as we
-        // want it to be about a million so it is as large as possible for greatest resolution.
-        // (The maximum denominator is 1048575.)
-        // This sets a maximum crystal of over 28MHz (crystal should be 25MHz or 27MHz)
-        // This allows us to use 32 bit integers.
-        // The error in the resulting frequency will be less than 1Hz
-        #define DENOM_RATIO 27
-        c = xtalFreq / DENOM_RATIO;
-        
-        // Calculate the pllFrequency: the divider * desired output frequency
-        pllFreq[pll] = divider * frequency;
-
-        // Determine the multiplier to get to the required pllFrequency
-        // Integer part is easy
-        a = pllFreq[pll] / xtalFreq;
-        
-        // Work out the fractional part (b/c)
-        // c is the denominator set above
-        // Can easily get b because we set c as a fraction of xtalFreq
-        // b = (pllFreq % xtalFreq) * c / xtalFreq
-        // but c is xtalFreq/27 so we get:
-        b = (pllFreq[pll] % xtalFreq) / DENOM_RATIO;
-
-        // Calculate the values as defined in AN619
-        uint32_t p = 128 * b / c;
-        P1 = 128 * a + p - 512;
-        P2 = 128 * b - c * p;
-        P3 = c;
-        
-        // Work out the new register values
-        newPll[pll][0] = (P3 & 0x0000FF00) >> 8;
-        newPll[pll][1] = (P3 & 0x000000FF);
-        newPll[pll][2] = (P1 & 0x00030000) >> 16;
-        newPll[pll][3] = (P1 & 0x0000FF00) >> 8;
-        newPll[pll][4] = (P1 & 0x000000FF);
-        newPll[pll][5] = ((P3 & 0x000F0000) >> 12) | ((P2 & 0x000F0000) >> 16);
-        newPll[pll][6] = (P2 & 0x0000FF00) >> 8;
-        newPll[pll][7] = (P2 & 0x000000FF);
-
-        // Write those registers that have changed
-        for( int i = 0 ; i < NUM_PLL_BYTES ; i++ )
-        {
-            // Write changed registers and always register 7. It appears that writing
-            // this last register latches in the new values.
-            if( i == 7 || (newPll[pll][i] != prevPll[pll][i]) )
-            {
-                i2cWriteRegister(SI5351A_I2C_ADDRESS, synthPLL[pll] + i, newPll[pll][i]);
-                prevPll[pll][i] = newPll[pll][i];
-            }
-        }
+        // Only the bytes that have changed are sent but always write register 7.
+        // It appears that writing this last register latches in the new values.
+        i2cCacheInvalidateRegister(pDev->addr, synthPLL[pll] + 7);
+        i2cCacheWriteRegisters(pDev->addr, synthPLL[pll], regs, NUM_PLL_BYTES);
     }
 }
+#endif
 
 //
-// Set up MultiSynth with divider a+b/c and R divider
+// Work out the MultiSynth register values for divider a+b/c and R divider
 // R divider is the bit value which is OR'ed onto the appropriate register, it is a #define in si5351a.h
 // 
 //
-static void setupMultisynth(uint8_t synth, uint32_t a, uint32_t b, uint32_t c, uint8_t rDiv)
+static void calcMultisynth(uint32_t a, uint32_t b, uint32_t c, uint8_t rDiv, uint8_t *regs)
 {
     uint32_t P1;					// Synth config register P1
     uint32_t P2;					// Synth config register P2
@@ -168,9 +306,7 @@ static void setupMultisynth(uint8_t synth, uint32_t a, uint32_t b, uint32_t c, u
     uint8_t  Div4 = 0;              // Divide by 4 bits
 
     // Calculate the values as defined in AN619
-    uint32_t p = 128 * b / c;
-    P1 = 128 * a + p - 512;
-    P2 = 128 * b - c * p;
+    calcP1P2( a, b, c, &P1, &P2 );
     P3 = c;
 
     // If the divider is 4 then special bits to set
@@ -179,36 +315,49 @@ static void setupMultisynth(uint8_t synth, uint32_t a, uint32_t b, uint32_t c, u
         Div4 = 0x0c;
     }
 
-    i2cWriteRegister(SI5351A_I2C_ADDRESS, synth + 0,   (P3 & 0x0000FF00) >> 8);
-    i2cWriteRegister(SI5351A_I2C_ADDRESS, synth + 1,   (P3 & 0x000000FF));
-    i2cWriteRegister(SI5351A_I2C_ADDRESS, synth + 2,   ((P1 & 0x00030000) >> 16) | rDiv | Div4 );
-    i2cWriteRegister(SI5351A_I2C_ADDRESS, synth + 3,   (P1 & 0x0000FF00) >> 8);
-    i2cWriteRegister(SI5351A_I2C_ADDRESS, synth + 4,   (P1 & 0x000000FF));
-    i2cWriteRegister(SI5351A_I2C_ADDRESS, synth + 5,   ((P3 & 0x000F0000) >> 12) | ((P2 & 0x000F0000) >> 16));
-    i2cWriteRegister(SI5351A_I2C_ADDRESS, synth + 6,   (P2 & 0x0000FF00) >> 8);
-    i2cWriteRegister(SI5351A_I2C_ADDRESS, synth + 7,   (P2 & 0x000000FF));
+    regs[0] = (P3 & 0x0000FF00) >> 8;
+    regs[1] = (P3 & 0x000000FF);
+    regs[2] = ((P1 & 0x00030000) >> 16) | rDiv | Div4;
+    regs[3] = (P1 & 0x0000FF00) >> 8;
+    regs[4] = (P1 & 0x000000FF);
+    regs[5] = ((P3 & 0x000F0000) >> 12) | ((P2 & 0x000F0000) >> 16);
+    regs[6] = (P2 & 0x0000FF00) >> 8;
+    regs[7] = (P2 & 0x000000FF);
+}
+
+#if !defined(OSC_PLANNER) || defined(OSC_SWEEP)
+//
+// Set up one or more consecutive MultiSynths with the calculated register values
+//
+static void setupMultisynth(struct sOscDevice *pDev, uint8_t synth, const uint8_t *regs, uint8_t num)
+{
+    // Only the runs of changed registers are sent
+    i2cCacheWriteRegisters(pDev->addr, synth, regs, num * NUM_MS_BYTES);
 }
+#endif
 
 //
-// Switches off Si5351a output
-// Example: si5351aOutputOff(SI_CLK0_CONTROL);
-// will switch off output CLK0
+// Switches off the Si5351a outputs from CLK0 in one write
 //
-static void si5351aOutputOff(uint8_t clk)
+// num The number of outputs, up to 8
+static void si5351aOutputsOff(struct sOscDevice *pDev, uint8_t num)
 {
-    i2cWriteRegister(SI5351A_I2C_ADDRESS, clk, 0x80);		// Refer to SiLabs AN619 to see bit values - 0x80 turns off the output stage
+    uint8_t regs[8];
+
+    memset( regs, 0x80, num );		// Refer to SiLabs AN619 to see bit values - 0x80 turns off the output stage
+    i2cCacheWriteRegisters(pDev->addr, SI_CLK0_CONTROL, regs, num);
 }
 
 // Enable/disable the clock output
 //
 // clk The clock bit (or bits)
 // bEnable true to enable and false to disable
-static void si5351aOutputEnable( uint8_t clk, bool bEnable )
+static void si5351aOutputEnable( struct sOscDevice *pDev, uint8_t clk, bool bEnable )
 {
     uint8_t reg;
 
-    // Read the existing register
-    if( i2cReadRegister(SI5351A_I2C_ADDRESS, SI_CLK_ENABLE, &reg) == 0 )
+    // Read the existing register - this will usually come from the cache
+    if( i2cCacheReadRegister(pDev->addr, SI_CLK_ENABLE, &reg) == 0 )
     {
         if( bEnable )
         {
@@ -220,171 +369,410 @@ static void si5351aOutputEnable( uint8_t clk, bool bEnable )
             // Disable by setting the bit
             reg |= clk;
         }
-        i2cWriteRegister( SI5351A_I2C_ADDRESS, SI_CLK_ENABLE, reg );
+        i2cCacheWriteRegister( pDev->addr, SI_CLK_ENABLE, reg );
     }
 }
 
 // Enable/disable a clock output
-void oscClockEnable( uint8_t clock, bool bEnable )
+void oscDevClockEnable( struct sOscDevice *pDev, uint8_t clock, bool bEnable )
 {
     if( clock < NUM_CLOCKS )
     {
-        si5351aOutputEnable( SI_CLK_ENABLE_0 << clock, bEnable );
+        si5351aOutputEnable( pDev, SI_CLK_ENABLE_0 << clock, bEnable );
     }
 }
 
-// Get the multisynth divider for the frequency
+// The band plan gives the multisynth divider for each range of frequencies.
+// Each entry is the frequency the band goes up to (but not including)
+// and the even integer divider used below that. The entries must be in
+// order of frequency and the last one catches all higher frequencies.
+// An application can set its own in config.h.
+//
 // These have been chosen for the maximum range to avoid
 // glitches while tuning. None of the transitions happen in
 // an amateur band.
 // These are so that the VCO is in the range 600-900MHz.
-static uint32_t getMultisynthDivider( uint32_t frequency, bool bQuadrature )
+#ifndef OSC_BAND_PLAN
+#define OSC_BAND_PLAN       \
+    {    800000, 900 },     \
+    {   1200000, 750 },     \
+    {   1700000, 528 },     \
+    {   2500000, 360 },     \
+    {   3400000, 264 },     \
+    {   5000000, 180 },     \
+    {   7500000, 120 },     \
+    {  10000000,  86 },     \
+    {  15000000,  60 },     \
+    {  20000000,  40 },     \
+    {  30000000,  30 },     \
+    {  45000000,  20 },     \
+    {  64000000,  14 },     \
+    {  90000000,  10 },     \
+    { 110000000,   8 },     \
+    { 150000000,   6 },     \
+    {         0,   4 }
+#endif
+
+// For quadrature output the maximum divider is 126 so we
+// have to use lower VCO frequencies for some bands.
+// This will limit the possible frequency range.
+#ifndef OSC_QUADRATURE_BAND_PLAN
+#define OSC_QUADRATURE_BAND_PLAN \
+    {   5000000, 126 },     \
+    {   7500000, 120 },     \
+    {  10000000,  86 },     \
+    {  15000000,  60 },     \
+    {  20000000,  40 },     \
+    {  30000000,  30 },     \
+    {  45000000,  20 },     \
+    {  64000000,  14 },     \
+    {  90000000,  10 },     \
+    { 110000000,   8 },     \
+    { 150000000,   6 },     \
+    {         0,   4 }
+#endif
+
+// The divider is kept while the VCO stays in this range
+#ifndef OSC_VCO_MIN
+#define OSC_VCO_MIN 600000000
+#endif
+#ifndef OSC_VCO_MAX
+#define OSC_VCO_MAX 900000000
+#endif
+
+// Largest divider that can be used in quadrature
+#define MAX_QUADRATURE_DIVIDER 126
+
+struct sOscBand
 {
-    uint32_t divider = 0;
+    uint32_t maxFreq;       // Band is below this frequency
+    uint16_t divider;       // Multisynth divider for the band
+};
 
-    // For quadrature output the maximum divider is 126 so we
-    // have to use lower VCO frequencies for some bands.
-    // This will limit the possible frequency range.
-    if( bQuadrature )
-    {
-        if( frequency < 5000000 )
-        {
-            divider = 126;
-        }
-    }
-    else
+static const struct sOscBand oscBandPlan[] PROGMEM = { OSC_BAND_PLAN };
+static const struct sOscBand oscQuadratureBandPlan[] PROGMEM = { OSC_QUADRATURE_BAND_PLAN };
+
+#define NUM_BANDS               (sizeof(oscBandPlan)/sizeof(oscBandPlan[0]))
+#define NUM_QUADRATURE_BANDS    (sizeof(oscQuadratureBandPlan)/sizeof(oscQuadratureBandPlan[0]))
+
+// Look up the divider for the frequency in a band plan with a binary search
+static uint16_t bandPlanDivider( const struct sOscBand *pPlan, uint8_t numBands, uint32_t frequency )
+{
+    uint8_t lo = 0;
+    uint8_t hi = numBands - 1;
+
+    // Find the first band that the frequency is below
+    // The last band is never compared so catches everything else
+    while( lo < hi )
     {
-        // If not requiring quadrature then can use any divider up to 900
-        if( frequency < 800000 )
-        {
-            divider = 900;
-        }
-        else if( frequency < 1200000 )
-        {
-            divider = 750;
-        }
-        else if( frequency < 1700000 )
-        {
-            divider = 528;
-        }
-        else if( frequency < 2500000 )
-        {
-            divider = 360;
-        }
-        else if( frequency < 3400000 )
+        uint8_t mid = (lo + hi) / 2;
+
+        if( frequency < pgm_read_dword( &pPlan[mid].maxFreq ) )
         {
-            divider = 264;
+            hi = mid;
         }
-        else if( frequency < 5000000 )
+        else
         {
-            divider = 180;
+            lo = mid + 1;
         }
     }
 
-    if( divider == 0 )
+    return pgm_read_word( &pPlan[lo].divider );
+}
+
+// Choose the multisynth divider for the frequency given the divider
+// last used on the PLL.
+// The last divider is kept as long as the VCO stays in range. Only
+// once it would leave the range is the band plan used.
+// This means tuning back and forth across a band plan boundary
+// doesn't keep changing the divider which resets the PLL and glitches
+// the output.
+static uint32_t chooseMultisynthDivider( uint32_t divider, uint32_t frequency, bool bQuadrature )
+{
+    uint64_t vco = (uint64_t) divider * frequency;
+
+    if( (bQuadrature && (divider > MAX_QUADRATURE_DIVIDER)) ||
+        (vco < OSC_VCO_MIN) || (vco > OSC_VCO_MAX) )
     {
-        if( frequency < 7500000 )
-        {
-            divider = 120;
-        }
-        else if( frequency < 10000000 )
-        {
-            divider = 86;
-        }
-        else if( frequency < 15000000 )
-        {
-            divider = 60;
-        }
-        else if( frequency < 20000000 )
-        {
-            divider = 40;
-        }
-        else if( frequency < 30000000 )
-        {
-            divider = 30;
-        }
-        else if( frequency < 45000000 )
-        {
-            divider = 20;
-        }
-        else if( frequency < 64000000 )
+        if( bQuadrature )
         {
-            divider = 14;
+            divider = bandPlanDivider( oscQuadratureBandPlan, NUM_QUADRATURE_BANDS, frequency );
         }
-        else if( frequency < 90000000 )
+        else
         {
-            divider = 10;
+            divider = bandPlanDivider( oscBandPlan, NUM_BANDS, frequency );
         }
-        else if( frequency < 110000000 )
+    }
+
+    return divider;
+}
+
+#ifndef OSC_PLANNER
+// Get the multisynth divider for the frequency on a PLL
+// and note it as the last one used.
+static uint32_t getMultisynthDivider( struct sOscDevice *pDev, uint8_t pll, uint32_t frequency, bool bQuadrature )
+{
+    pDev->pllDivider[pll] = chooseMultisynthDivider( pDev->pllDivider[pll], frequency, bQuadrature );
+
+    return pDev->pllDivider[pll];
+}
+#endif
+
+// Limit the integer part of a multisynth divider to the legal values.
+// Returns true if it was limited in which case the divider is now an integer.
+static bool limitDivider( uint32_t *pa, uint32_t *pb, uint32_t *pc )
+{
+    bool bLimited = true;
+
+    // Maximum possible divider is 900
+    if( *pa >= 900 )
+    {
+        *pa = 900;
+    }
+
+    // Below 8 only 4 or 6 are legal
+    else if( *pa < 8 )
+    {
+        if( *pa == 7 )
         {
-            divider = 8;
+            *pa = 8;
         }
-        else if( frequency < 150000000 )
+        else if( *pa == 5 )
         {
-            divider = 6;
+            *pa = 6;
         }
         else
         {
-            divider = 4;
+            *pa = 4;
         }
     }
-    return divider;
+    else
+    {
+        bLimited = false;
+    }
+
+    if( bLimited )
+    {
+        *pb = 0;
+        *pc = 1;
+    }
+
+    return bLimited;
 }
 
 // Calculate the divider (a+b/c) for a given clock frequency and PLL frequency
 static void calcDivider( uint32_t clockFreq, uint32_t pllFreq, uint32_t *pa, uint32_t *pb, uint32_t *pc )
 {
     // Intermediate calculations
-    uint32_t d, r;
+    uint32_t d, r, rem;
 
     // Firstly work out the divider a and the remainder
-    *pa = pllFreq / clockFreq;
-    r = pllFreq % clockFreq;
-
-    // b/c == r/frequency but we can't use these directly since
-    // c can only be up to 1048575 so have to scale for this
-    // We will scale by d to achieve this
-    // (1000000/48575 is about 21)
-    if( clockFreq < 21000000 )
+    // If it would be 1024 or more (or the clock is off) then
+    // there is no need to work it out as it is limited to 900 below
+    if( (pllFreq >> 10) >= clockFreq )
     {
-        d = 21;
+        *pa = 1024;
     }
     else
     {
-        d = clockFreq / 1000000;
+        *pa = divSmall( pllFreq, clockFreq, 10, &r );
+    }
+
+    if( !limitDivider( pa, pb, pc ) )
+    {
+        // b/c == r/frequency but we can't use these directly since
+        // c can only be up to 1048575 so have to scale for this
+        // We will scale by d to achieve this
+        // (1000000/48575 is about 21)
+        if( clockFreq < 21000000 )
+        {
+            // Both quotients are under 2^20
+            *pb = divSmall( r, 21, 20, &rem );
+            *pc = divSmall( clockFreq, 21, 20, &rem );
+        }
+        else
+        {
+            // The divider is at least 8 so the clock is under 256MHz
+            d = divSmall( clockFreq, 1000000, 8, &rem );
+
+            // c is about a million so fits in 21 bits
+            *pb = divSmall( r, d, 21, &rem );
+            *pc = divSmall( clockFreq, d, 21, &rem );
+        }
     }
+}
 
-    *pb = r / d;
-    *pc = clockFreq / d;
+// Largest fractional denominator the PLLs and multisynths take
+#define MAX_DENOM 1048575
 
-    // Maximum possible divider is 900
-    if( *pa >= 900 )
+// Find the fraction b/c closest to n/d (which must be less than 1)
+// with c no more than MAX_DENOM using continued fractions.
+//
+// The convergents' denominators grow at least as fast as the Fibonacci
+// numbers so there are no more than 30 steps. Most terms are 1 which
+// is found with a subtraction; larger terms need a 32 bit division.
+static void approxFraction( uint64_t n, uint64_t d, uint32_t *pb, uint32_t *pc )
+{
+    // Scale down to 32 bits. The error this makes is much less
+    // than the resolution of a 20 bit denominator.
+    while( d >> 32 )
     {
-        *pa = 900;
-        *pb = 0;
-        *pc = 1;
+        n >>= 1;
+        d >>= 1;
     }
 
-    // Below 8 only 4 or 6 are legal
-    else if( *pa < 8 )
+    // The fraction being approximated
+    const uint32_t num = n, den = d;
+
+    // Numerator and denominator remaining in the expansion
+    uint32_t rn = num, rd = den;
+
+    // The last two convergents
+    uint32_t p = 0, q = 1;
+    uint32_t pPrev = 1, qPrev = 0;
+
+    while( rn != 0 )
     {
-        if( *pa == 7 )
+        // Next term of the continued fraction
+        uint32_t t, r;
+
+        if( rd - rn < rn )
         {
-            *pa = 8;
+            t = 1;
+            r = rd - rn;
         }
-        else if( *pa == 5 )
+        else
         {
-            *pa = 6;
+            t = rd / rn;
+            r = rd % rn;
         }
-        else
+
+        if( (uint64_t) t * q + qPrev > MAX_DENOM )
         {
-            *pa = 4;
+            // The next convergent is out of range so use the
+            // semiconvergent with the largest denominator
+            // if it is closer than the last convergent.
+            uint32_t tMax = (MAX_DENOM - qPrev) / q;
+            uint32_t ps = tMax * p + pPrev;
+            uint32_t qs = tMax * q + qPrev;
+
+            // Compare |num/den - p/q| with |num/den - ps/qs|
+            int64_t e  = (int64_t)num * q  - (int64_t)p  * den;
+            int64_t es = (int64_t)num * qs - (int64_t)ps * den;
+
+            if( e < 0 ) e = -e;
+            if( es < 0 ) es = -es;
+
+            if( (uint64_t)es * q < (uint64_t)e * qs )
+            {
+                p = ps;
+                q = qs;
+            }
+            break;
         }
-        *pb = 0;
-        *pc = 1;
+
+        uint32_t pNext = t * p + pPrev;
+        uint32_t qNext = t * q + qPrev;
+
+        pPrev = p;
+        qPrev = q;
+        p = pNext;
+        q = qNext;
+
+        rd = rn;
+        rn = r;
+    }
+
+    *pb = p;
+    *pc = q;
+}
+
+// Work out the register values for a PLL with the specified integer
+// divider and frequency in millihertz using the closest fraction
+// for the PLL multiplier.
+// Returns the PLL frequency in millihertz
+static uint64_t calcPLLExact( struct sOscDevice *pDev, uint32_t divider, uint64_t frequency, uint8_t *regs )
+{
+    uint64_t pllFreq = divider * frequency;
+    uint64_t xtal = (uint64_t) pDev->xtalFreq * 1000;
+    uint64_t rem;
+    uint32_t a, b, c;
+
+    // The PLL multiplier is below 256
+    a = divSmall64( pllFreq, xtal, 8, &rem );
+    approxFraction( rem, xtal, &b, &c );
+
+    // The PLL registers have the same layout as the multisynth ones
+    calcMultisynth( a, b, c, SI_R_DIV_1, regs );
+
+    return pllFreq;
+}
+
+// Calculate the divider (a+b/c) for a clock frequency and PLL frequency
+// in millihertz using the closest fraction
+static void calcDividerExact( uint64_t clockFreq, uint64_t pllFreq, uint32_t *pa, uint32_t *pb, uint32_t *pc )
+{
+    uint64_t rem = 0;
+
+    if( (pllFreq >> 10) >= clockFreq )
+    {
+        *pa = 1024;
+    }
+    else
+    {
+        *pa = divSmall64( pllFreq, clockFreq, 10, &rem );
+    }
+
+    if( !limitDivider( pa, pb, pc ) )
+    {
+        approxFraction( rem, clockFreq, pb, pc );
     }
 }
 
+// floor(x * m / d) without overflowing as long as m * d fits in 64 bits
+static uint64_t mulDiv( uint64_t x, uint64_t m, uint64_t d )
+{
+    return (x / d) * m + ((x % d) * m) / d;
+}
+
+// Get the divider ratio from PLL or multisynth register values
+// It is (P1 + 512 + P2/P3) / 128 which is returned as *pNum / (128 * P3)
+static uint32_t decodeDivider( const uint8_t *regs, uint64_t *pNum )
+{
+    uint32_t P1 = ((uint32_t)(regs[2] & 0x03) << 16) | ((uint16_t)regs[3] << 8) | regs[4];
+    uint32_t P2 = ((uint32_t)(regs[5] & 0x0F) << 16) | ((uint16_t)regs[6] << 8) | regs[7];
+    uint32_t P3 = ((uint32_t)(regs[5] & 0xF0) << 12) | ((uint16_t)regs[0] << 8) | regs[1];
+
+    *pNum = (uint64_t)(P1 + 512) * P3 + P2;
+
+    return P3;
+}
+
+// Work out the output frequency in millihertz (rounded to the nearest)
+// from the PLL and multisynth register values
+// This uses the library 64 bit division but only reports the result
+// so the registers have already been sent when it is called.
+static uint64_t decodeFrequency( struct sOscDevice *pDev, const uint8_t *pll, const uint8_t *ms )
+{
+    uint64_t num;
+    uint32_t c;
+    uint64_t freq;
+    uint8_t shift;
+
+    // PLL frequency is xtal * num / (128 * c)
+    // Work in eighths of a millihertz to keep the rounding errors small
+    c = decodeDivider( pll, &num );
+    freq = mulDiv( (uint64_t) pDev->xtalFreq * 8000, num, 128 * (uint64_t) c );
+
+    // Output is PLL * 128 * c / num then the R divider
+    c = decodeDivider( ms, &num );
+    freq = mulDiv( freq * 128, c, num );
+
+    shift = 3 + ((ms[2] >> 4) & 0x07);
+
+    return (freq + (1 << (shift - 1))) >> shift;
+}
+
 // Get the R Div for the frequency. Only used for low frequencies
 // below 1MHz. With this extra divider have to change the clock
 // frequency too.
@@ -455,214 +843,1622 @@ static uint8_t getRDiv( uint32_t *pFreq )
     return rDiv;
 }
 
-// Set the clock to the given frequency with optional quadrature.
-//
-// quadrature is only used for clock 1 - it is ignored for the others
-// +ve is CLK1 leads CLK0 by 90 degrees
-// -ve is CLK1 lags  CLK0 by 90 degrees
-// 0 is no quadrature i.e. set the frequency as normal
-// When quadrature is set for clock 1 then it is set to the same frequency as clock 0
-void oscSetFrequency( uint8_t clock, uint32_t frequency, int8_t q )
+// Work out the PLL register values for a clock frequency with an integer divider.
+// If bExact is set milliHz is added to the frequency and the closest
+// fraction is used.
+// Returns the PLL frequency in hertz and in millihertz in *pPllMilliHz
+static uint32_t calcFreqPLL( struct sOscDevice *pDev, uint32_t freq, uint16_t milliHz, bool bExact, uint32_t divider, uint8_t *regs, uint64_t *pPllMilliHz )
 {
-    // Whether quadrature has been enabled
-    static int8_t quadrature;
+    uint32_t pllFreq;
 
-    // To get the output frequency the PLL is divided by a+b/c
-    uint32_t a, b, c;
-
-    // Clocks 0 and 1 share a PLL so need a divider for the other clock
-    uint32_t a1, b1, c1;
-
-    // The PLL clock and reset bits for this clock
-    uint8_t pll_clock, pll_reset;
+    if( bExact )
+    {
+        uint32_t rem;
 
-    // The first (or only) clock we are setting
-    uint8_t firstClock;
+        *pPllMilliHz = calcPLLExact( pDev, divider, (uint64_t) freq * 1000 + milliHz, regs );
 
-    // We will reset the PLLs only when the divider or quadrature changes
-    static uint32_t prevDivider[NUM_CLOCKS];
-    static int8_t prevQuadrature;
+        // Split the fraction of a hertz off the part from milliHz alone
+        // so only a small 32 bit division is needed
+        pllFreq = divider * freq + divSmall( divider * milliHz, 1000, 11, &rem );
+    }
+    else
+    {
+        pllFreq = calcPLL( pDev, divider, freq, regs );
+        *pPllMilliHz = (uint64_t) pllFreq * 1000;
+    }
 
-    static uint8_t rDiv[NUM_CLOCKS];
+    return pllFreq;
+}
 
-    if( clock < NUM_CLOCKS )
+// Calculate the divider (a+b/c) for a clock frequency from the PLL frequency
+static void calcFreqDivider( uint32_t freq, uint16_t milliHz, bool bExact, uint32_t pllFreq, uint64_t pllMilliHz, uint32_t *pa, uint32_t *pb, uint32_t *pc )
+{
+    if( bExact )
+    {
+        calcDividerExact( (uint64_t) freq * 1000 + milliHz, pllMilliHz, pa, pb, pc );
+    }
+    else
     {
-        // Lower frequencies need an extra R Divider
-        // in which case we have to increase the actual clock frequency
-        rDiv[clock] = getRDiv( &frequency );
+        calcDivider( freq, pllFreq, pa, pb, pc );
+    }
+}
 
-        // Keep track of each clock's frequency
-        clockFreq[clock] = frequency;
+// The register values for the clocks on a PLL
+struct sOscImage
+{
+    uint8_t  pll[NUM_PLL_BYTES];    // PLL
+    uint8_t  ms[2][NUM_MS_BYTES];   // Multisynths for clocks 0 and 1 or just clock 2
+    uint16_t a;                     // Integer part of the clock 0 or clock 2 divider
+};
 
-        // For clock 1 we note the quadrature setting - this can also affect clock 0 because
-        // we are limited in the dividers we can use in quadrature
-        if( clock == 1 )
-        {
-            quadrature = q;
+#ifndef OSC_PLANNER
+// What the register values for the clocks on a PLL depend on.
+// Clocks 0 and 1 share PLL A so both their frequencies are needed.
+struct sOscImageKey
+{
+    struct sOscDevice *pDev;    // Device as the crystals may differ
+    uint32_t freq[2];       // Clock frequencies after the R divider
+    uint8_t  rDiv[2];       // R dividers
+    uint8_t  bQuadrature;   // Clocks 0 and 1 are in quadrature
+    uint8_t  bPllB;         // Clock 2 on PLL B
+    uint16_t milliHz[2];    // Fractions of a hertz after the R divider
+    uint8_t  bExact[2];     // Use the closest fraction rather than 1Hz resolution
+    uint16_t divider;       // Integer divider of the clock that sets the PLL
+};
 
-            // If the quadrature has changed then we set the previous divider to zero to 
-            // force the PLL to be reset
-            if( quadrature != prevQuadrature )
-            {
-                prevDivider[clock] = 0;
-                prevQuadrature = quadrature;
-            }
-        }
+// Number of recently used register values to keep so that
+// returning to a frequency doesn't need them working out again.
+// Set to 0 in config.h to save RAM.
+#ifndef OSC_IMAGE_CACHE_LEN
+#define OSC_IMAGE_CACHE_LEN 4
+#endif
 
-        // Get the predetermined multisynth divider for the frequency
-        if( clock == 2 )
-        {
-            a = getMultisynthDivider( frequency, false );
-            b = 0;
-            c = 1;
-            pll_reset = SI_PLL_RESET_B;
-            pll_clock = SI_CLK_SRC_PLL_B;
-            firstClock = 2;
+#if OSC_IMAGE_CACHE_LEN > 0
+// Most recently used first
+static struct sOscImageEntry
+{
+    struct sOscImageKey key;
+    struct sOscImage image;
+} oscImageCache[OSC_IMAGE_CACHE_LEN];
+static uint8_t numOscImages;
+#endif
+
+// Find out if clock 0 in the key is at least the frequency of clock 1
+static bool keyClock0Higher( const struct sOscImageKey *pKey )
+{
+    return (pKey->freq[0] > pKey->freq[1]) ||
+           ((pKey->freq[0] == pKey->freq[1]) && (pKey->milliHz[0] >= pKey->milliHz[1]));
+}
 
-            // Set up the PLL
-            setupPLL(SYNTH_PLL_B, a, frequency);
-        }
-        else
-        {
-            // In quadrature set clock 1 frequency to the same as clock 0
-            if( quadrature )
-            {
-                clockFreq[1] = clockFreq[0];
-                rDiv[1] = rDiv[0];
-            }
+// Work out the PLL register values for a clock in the key with an integer divider
+// Returns the PLL frequency in hertz and in millihertz in *pPllMilliHz
+static uint32_t calcKeyPLL( struct sOscDevice *pDev, const struct sOscImageKey *pKey, uint8_t i, uint32_t divider, uint8_t *regs, uint64_t *pPllMilliHz )
+{
+    return calcFreqPLL( pDev, pKey->freq[i], pKey->milliHz[i], pKey->bExact[i], divider, regs, pPllMilliHz );
+}
 
-            // Clocks 0 and 1 share PLL A so we set the divider based
-            // on the higher clock frequency.
-            // We will always set clock 0 first
-            firstClock = 0;
-            if( clockFreq[0] >= clockFreq[1] )
-            {
-                // Clock 0 is the higher frequency so get its integer divider
-                a = getMultisynthDivider( clockFreq[0], quadrature != 0 );
-                b = 0;
-                c = 1;
+// Calculate the divider (a+b/c) for a clock in the key
+static void calcKeyDivider( const struct sOscImageKey *pKey, uint8_t i, uint32_t pllFreq, uint64_t pllMilliHz, uint32_t *pa, uint32_t *pb, uint32_t *pc )
+{
+    calcFreqDivider( pKey->freq[i], pKey->milliHz[i], pKey->bExact[i], pllFreq, pllMilliHz, pa, pb, pc );
+}
 
-                // Set up the PLL
-                setupPLL(SYNTH_PLL_A, a, clockFreq[0]);
+// Work out the register values for the clocks on a PLL
+static void oscCalcImage( const struct sOscImageKey *pKey, struct sOscImage *pImage )
+{
+    struct sOscDevice *pDev = pKey->pDev;
 
-                // Work out the required divider for clock 1
-                if( quadrature )
+    // To get the output frequency the PLL is divided by a+b/c
+    uint32_t a, b, c;
+
+    // Clocks 0 and 1 share a PLL so need a divider for the other clock
+    uint32_t a1, b1, c1;
+
+    uint32_t pllFreq;
+    uint64_t pllMilliHz;
+
+    if( pKey->bPllB )
+    {
+        // Get the predetermined multisynth divider for the frequency
+        a = pKey->divider;
+        b = 0;
+        c = 1;
+
+        calcKeyPLL( pDev, pKey, 0, a, pImage->pll, &pllMilliHz );
+    }
+    else
+    {
+        // Clocks 0 and 1 share PLL A so we set the divider based
+        // on the higher clock frequency.
+        if( keyClock0Higher( pKey ) )
+        {
+            // Clock 0 is the higher frequency so get its integer divider
+            a = pKey->divider;
+            b = 0;
+            c = 1;
+
+            pllFreq = calcKeyPLL( pDev, pKey, 0, a, pImage->pll, &pllMilliHz );
+
+            // Work out the required divider for clock 1
+            if( pKey->bQuadrature )
+            {
+                // In quadrature clock 1 is the same frequency as clock 0
+                a1 = a;
+                b1 = b;
+                c1 = c;
+            }
+            else
+            {
+                calcKeyDivider( pKey, 1, pllFreq, pllMilliHz, &a1, &b1, &c1 );
+            }
+        }
+        else
+        {
+            // Clock 1 is the higher frequency so get its integer divider
+            // In quadrature mode won't get here as the oscillator frequencies are equal
+            a1 = pKey->divider;
+            b1 = 0;
+            c1 = 1;
+
+            pllFreq = calcKeyPLL( pDev, pKey, 1, a1, pImage->pll, &pllMilliHz );
+
+            // Work out the required divider for clock 0
+            calcKeyDivider( pKey, 0, pllFreq, pllMilliHz, &a, &b, &c );
+        }
+
+        calcMultisynth( a1, b1, c1, pKey->rDiv[1], pImage->ms[1] );
+    }
+
+    calcMultisynth( a, b, c, pKey->rDiv[0], pImage->ms[0] );
+    pImage->a = a;
+}
+
+// Get the register values for the clocks on a PLL.
+// They are only worked out if not found in the cache.
+static const struct sOscImage *oscGetImage( const struct sOscImageKey *pKey )
+{
+#if OSC_IMAGE_CACHE_LEN > 0
+    uint8_t i;
+
+    for( i = 0 ; i < numOscImages ; i++ )
+    {
+        if( memcmp( &oscImageCache[i].key, pKey, sizeof(*pKey) ) == 0 )
+        {
+            break;
+        }
+    }
+
+    if( i == numOscImages )
+    {
+        // Not found so replace the least recently used
+        if( numOscImages < OSC_IMAGE_CACHE_LEN )
+        {
+            numOscImages++;
+        }
+        i = numOscImages - 1;
+
+        oscImageCache[i].key = *pKey;
+        oscCalcImage( pKey, &oscImageCache[i].image );
+    }
+
+    // Move it to the front
+    if( i > 0 )
+    {
+        struct sOscImageEntry entry = oscImageCache[i];
+
+        for( ; i > 0 ; i-- )
+        {
+            oscImageCache[i] = oscImageCache[i - 1];
+        }
+        oscImageCache[0] = entry;
+    }
+
+    return &oscImageCache[0].image;
+#else
+    static struct sOscImage image;
+
+    oscCalcImage( pKey, &image );
+
+    return &image;
+#endif
+}
+
+#endif // OSC_PLANNER
+
+// Time for the multisynths to take changes before the outputs
+// are switched on and the PLL reset
+#ifndef OSC_SETTLE_US
+#define OSC_SETTLE_US 1000
+#endif
+
+// Wait for the multisynths to settle before finishing the change.
+// Each change restarts the wait but it is never put off for more than
+// twice the settle time from the first change waiting. Otherwise changes
+// less than the settle time apart, e.g. from a tuning knob, would keep
+// the outputs off and the PLL reset waiting.
+static void oscSettleStart( struct sOscDevice *pDev )
+{
+    uint32_t now = micros();
+
+    if( !pDev->settle.bPending )
+    {
+        pDev->settle.first = now;
+        pDev->settle.bPending = true;
+    }
+
+    if( (int32_t)(now - pDev->settle.first) < OSC_SETTLE_US )
+    {
+        pDev->settle.deadline = now + OSC_SETTLE_US;
+    }
+    else
+    {
+        pDev->settle.deadline = pDev->settle.first + 2 * OSC_SETTLE_US;
+    }
+}
+
+// Note the frequency of a clock ready for its PLL to be set up.
+//
+// quadrature is only used for clock 1 - it is ignored for the others
+// +ve is CLK1 leads CLK0 by 90 degrees
+// -ve is CLK1 lags  CLK0 by 90 degrees
+// 0 is no quadrature i.e. set the frequency as normal
+// When quadrature is set for clock 1 then it is set to the same frequency as clock 0
+//
+// If bExact is set milliHz is added to the frequency and the closest
+// fractions are used for the dividers.
+static void oscRecordFrequency( struct sOscDevice *pDev, uint8_t clock, uint32_t frequency, uint16_t milliHz, bool bExact, int8_t q )
+{
+    // Lower frequencies need an extra R Divider
+    // in which case we have to increase the actual clock frequency
+    pDev->rDiv[clock] = getRDiv( &frequency );
+
+#if NUM_CLOCKS > FIRST_INTEGER_CLOCK
+    // The integer only multisynths can't divide by more than 254 so
+    // the R divider has to do more to keep the VCO in range
+    while( (clock >= FIRST_INTEGER_CLOCK) && (frequency < OSC_VCO_MIN / MAX_INTEGER_DIVIDER) &&
+           (pDev->rDiv[clock] < SI_R_DIV_128) )
+    {
+        pDev->rDiv[clock] += SI_R_DIV_2;
+        frequency *= 2;
+    }
+#endif
+
+    // The fraction of a hertz has to be increased too
+    if( bExact )
+    {
+        uint32_t m = (uint32_t) milliHz << (pDev->rDiv[clock] >> 4);
+        uint32_t rem;
+
+        // m is below 128000
+        frequency += divSmall( m, 1000, 7, &rem );
+        milliHz = rem;
+    }
+    else
+    {
+        milliHz = 0;
+    }
+
+    // Keep track of each clock's frequency
+    pDev->clockFreq[clock] = frequency;
+    pDev->clockMilliHz[clock] = milliHz;
+    pDev->clockExact[clock] = bExact;
+
+    // For clock 1 we note the quadrature setting - this can also affect clock 0 because
+    // we are limited in the dividers we can use in quadrature
+    if( clock == 1 )
+    {
+        pDev->quadrature = q;
+
+        // If the quadrature has changed then we set the previous divider to zero to 
+        // force the PLL to be reset
+        if( pDev->quadrature != pDev->prevQuadrature )
+        {
+            pDev->prevDivider[clock] = 0;
+            pDev->prevQuadrature = pDev->quadrature;
+        }
+    }
+}
+
+#ifdef OSC_PLANNER
+// The planner shares out the PLLs between the clocks. One clock on each
+// PLL sets it with an even integer divider from the band plan and the
+// others take a divider from it. Each way of choosing the clocks that set
+// the PLLs is tried and the one with the lowest cost is used.
+//
+// Integer dividers have the least jitter, especially even ones.
+// A clock set to the millihertz is only exact if it sets its PLL.
+// Moving a running clock to the other PLL or resetting its PLL glitches
+// the output once whereas a fractional divider is there for good.
+// A divider that can't be set makes the frequency wrong.
+#define PLAN_COST_ODD           1
+#define PLAN_COST_FRACTIONAL    8
+#define PLAN_COST_INEXACT       8
+#define PLAN_COST_GLITCH        4
+#define PLAN_COST_WRONG         1000
+
+// No clock sets the PLL
+#define NO_CLOCK    0xFF
+
+// Parts of the block of PLL and multisynth registers
+#define PART_PLL(pll)       (1 << (pll))
+#define PART_MS(clock)      (1 << (2 + (clock)))
+#define PART_R_DIV_67       (1 << 10)
+
+// Register values for the clock being set by oscStartFrequency()
+static struct sOscImage oscPlanImage;
+
+// Find out if a clock needs a PLL i.e. it has been set
+static bool planActive( struct sOscDevice *pDev, uint8_t clock )
+{
+    return pDev->clockFreq[clock] != 0;
+}
+
+// Find out if clock 1 follows clock 0 in quadrature
+static bool planQuadrature( struct sOscDevice *pDev )
+{
+    return pDev->quadrature && planActive( pDev, 0 );
+}
+
+// Get the divider for a clock that sets a PLL
+static uint32_t planDivider( struct sOscDevice *pDev, uint8_t pll, uint8_t clock, bool bQuadrature )
+{
+    uint32_t divider = chooseMultisynthDivider( pDev->pllDivider[pll], pDev->clockFreq[clock], bQuadrature );
+
+    if( (clock >= FIRST_INTEGER_CLOCK) && (divider > MAX_INTEGER_DIVIDER) )
+    {
+        divider = MAX_INTEGER_DIVIDER;
+    }
+
+    return divider;
+}
+
+// Cost of a clock taking its divider from a PLL set by another clock.
+// bWhole is set if the PLL is a whole number of hertz.
+static uint16_t planClockCost( struct sOscDevice *pDev, uint8_t clock, uint32_t pllFreq, bool bWhole )
+{
+    uint32_t f = pDev->clockFreq[clock];
+    uint32_t a, r;
+    uint16_t cost = 0;
+    bool bInteger;
+
+    // The divider can't be more than 900 anyway
+    if( (pllFreq >> 10) >= f )
+    {
+        return PLAN_COST_WRONG;
+    }
+
+    a = divSmall( pllFreq, f, 10, &r );
+    bInteger = bWhole && (r == 0) && (pDev->clockMilliHz[clock] == 0);
+
+    if( pDev->clockExact[clock] && !bInteger )
+    {
+        cost = PLAN_COST_INEXACT;
+    }
+
+    if( clock >= FIRST_INTEGER_CLOCK )
+    {
+        // Only even integers from 6 to 254
+        if( bInteger && !(a & 1) && (a >= 6) && (a <= MAX_INTEGER_DIVIDER) )
+        {
+            return cost;
+        }
+    }
+    else if( bInteger && ((a == 4) || (a == 6) || ((a >= 8) && (a <= 900))) )
+    {
+        return cost + ((a & 1) ? PLAN_COST_ODD : 0);
+    }
+    else if( (a >= 8) && (a < 900) )
+    {
+        return cost + PLAN_COST_FRACTIONAL;
+    }
+
+    return PLAN_COST_WRONG;
+}
+
+// Work out the cost of a plan with the given clocks setting the PLLs.
+// The PLL for each clock is put in pllOf.
+static uint16_t planCost( struct sOscDevice *pDev, const uint8_t *pMaster, uint8_t *pllOf )
+{
+    uint32_t divider[NUM_SYNTH_PLL];
+    uint32_t pllFreq[NUM_SYNTH_PLL];
+    bool     bWhole[NUM_SYNTH_PLL];
+    bool     bQuadrature = planQuadrature( pDev );
+    uint16_t cost = 0;
+    uint8_t  resets = 0;
+    uint8_t  pll, clock;
+
+    for( pll = 0 ; pll < NUM_SYNTH_PLL ; pll++ )
+    {
+        uint8_t m = pMaster[pll];
+
+        if( m != NO_CLOCK )
+        {
+            divider[pll] = planDivider( pDev, pll, m, bQuadrature && (m == 0) );
+            pllFreq[pll] = divider[pll] * pDev->clockFreq[m];
+            bWhole[pll] = (pDev->clockMilliHz[m] == 0);
+            pllOf[m] = pll;
+        }
+    }
+
+    for( clock = 0 ; clock < NUM_CLOCKS ; clock++ )
+    {
+        if( !planActive( pDev, clock ) || (clock == pMaster[SYNTH_PLL_A]) || (clock == pMaster[SYNTH_PLL_B]) )
+        {
+            continue;
+        }
+
+        if( bQuadrature && (clock == 1) )
+        {
+            // In quadrature clock 1 has the same divider as clock 0
+            pllOf[1] = pllOf[0];
+        }
+        else
+        {
+            uint16_t best = UINT16_MAX;
+
+            for( pll = 0 ; pll < NUM_SYNTH_PLL ; pll++ )
+            {
+                if( pMaster[pll] != NO_CLOCK )
                 {
-                    // In quadrature clock 1 is the same frequency as clock 0
-                    a1 = a;
-                    b1 = b;
-                    c1 = c;
+                    uint16_t c = planClockCost( pDev, clock, pllFreq[pll], bWhole[pll] );
+
+                    if( (pDev->planClocks & (1 << clock)) && (pDev->clockPLL[clock] != pll) )
+                    {
+                        c += PLAN_COST_GLITCH;
+                    }
+
+                    if( c < best )
+                    {
+                        best = c;
+                        pllOf[clock] = pll;
+                    }
                 }
-                else
+            }
+            cost += best;
+        }
+    }
+
+    // The PLLs that will be reset while they have running clocks
+    for( clock = 0 ; clock < NUM_CLOCKS ; clock++ )
+    {
+        if( (pDev->planClocks & (1 << clock)) && planActive( pDev, clock ) && (pMaster[pllOf[clock]] != NO_CLOCK) )
+        {
+            pll = pllOf[clock];
+
+            if( (divider[pll] != pDev->prevDivider[clock]) || (pDev->clockPLL[clock] != pll) )
+            {
+                resets |= (1 << pll);
+            }
+        }
+    }
+
+    for( pll = 0 ; pll < NUM_SYNTH_PLL ; pll++ )
+    {
+        if( resets & (1 << pll) )
+        {
+            cost += PLAN_COST_GLITCH;
+        }
+    }
+
+    return cost;
+}
+
+// Find out if the clocks can set the PLLs.
+// They must be different and in use. In quadrature clock 0 sets a
+// PLL for both clocks.
+static bool planValid( struct sOscDevice *pDev, const uint8_t *pMaster )
+{
+    uint8_t a = pMaster[SYNTH_PLL_A];
+    uint8_t b = pMaster[SYNTH_PLL_B];
+
+    if( ((a != NO_CLOCK) && !planActive( pDev, a )) ||
+        ((b != NO_CLOCK) && !planActive( pDev, b )) ||
+        ((a == b) && (a != NO_CLOCK)) )
+    {
+        return false;
+    }
+
+    return !planQuadrature( pDev ) || (((a == 0) || (b == 0)) && (a != 1) && (b != 1));
+}
+
+// Work out the cost of the given clocks setting the PLLs and use them
+// if it is less than the best so far
+static void planTry( struct sOscDevice *pDev, const uint8_t *master, uint8_t *pMaster, uint8_t *pllOf, uint16_t *pBest )
+{
+    uint8_t  trial[NUM_CLOCKS];
+    uint16_t cost;
+
+    if( planValid( pDev, master ) )
+    {
+        memcpy( trial, pDev->clockPLL, sizeof(trial) );
+
+        cost = planCost( pDev, master, trial );
+        if( cost < *pBest )
+        {
+            *pBest = cost;
+            memcpy( pMaster, master, NUM_SYNTH_PLL );
+            memcpy( pllOf, trial, sizeof(trial) );
+        }
+    }
+}
+
+// Choose the clocks that set the PLLs and the PLL for each of the others.
+// The last plan is tried first and is only replaced by one with a lower
+// cost so that the clocks don't move back and forth when the costs are equal.
+// When one clock has changed only the plans where it sets one of the PLLs
+// are tried as well, taking 2 * (NUM_CLOCKS + 1) tries rather than the
+// square of that. Every plan is tried if there is no clock given or none
+// of those can set all the clocks.
+static void oscPlan( struct sOscDevice *pDev, uint8_t changed, uint8_t *pMaster, uint8_t *pllOf )
+{
+    uint8_t  master[NUM_SYNTH_PLL];
+    uint16_t best = UINT16_MAX;
+
+    planTry( pDev, pDev->planMaster, pMaster, pllOf, &best );
+
+    if( changed != NO_CLOCK )
+    {
+        // NUM_CLOCKS is used for a PLL that no clock sets
+        for( uint8_t i = 0 ; i <= NUM_CLOCKS ; i++ )
+        {
+            master[SYNTH_PLL_A] = changed;
+            master[SYNTH_PLL_B] = (i < NUM_CLOCKS) ? i : NO_CLOCK;
+            planTry( pDev, master, pMaster, pllOf, &best );
+
+            master[SYNTH_PLL_A] = master[SYNTH_PLL_B];
+            master[SYNTH_PLL_B] = changed;
+            planTry( pDev, master, pMaster, pllOf, &best );
+        }
+
+        if( best < PLAN_COST_WRONG )
+        {
+            memcpy( pDev->planMaster, pMaster, sizeof(pDev->planMaster) );
+            return;
+        }
+    }
+
+    // NUM_CLOCKS is used for a PLL that no clock sets
+    for( uint8_t i = 0 ; i <= NUM_CLOCKS ; i++ )
+    {
+        for( uint8_t j = 0 ; j <= NUM_CLOCKS ; j++ )
+        {
+            master[SYNTH_PLL_A] = (i < NUM_CLOCKS) ? i : NO_CLOCK;
+            master[SYNTH_PLL_B] = (j < NUM_CLOCKS) ? j : NO_CLOCK;
+
+            planTry( pDev, master, pMaster, pllOf, &best );
+        }
+    }
+
+    memcpy( pDev->planMaster, pMaster, sizeof(pDev->planMaster) );
+}
+
+// Find the part of the block of PLL and multisynth registers that a
+// register is in
+static uint8_t synthPart( uint8_t reg )
+{
+    if( reg < SI_SYNTH_MS_0 )
+    {
+        return (reg - SI_SYNTH_PLL_A) / 8;
+    }
+    else if( reg < SI_SYNTH_MS_6 )
+    {
+        return 2 + (reg - SI_SYNTH_MS_0) / 8;
+    }
+    else if( reg < SI_SYNTH_R_DIV_67 )
+    {
+        return 2 + FIRST_INTEGER_CLOCK + (reg - SI_SYNTH_MS_6);
+    }
+    else
+    {
+        return 10;
+    }
+}
+
+// Write the parts of the block of PLL and multisynth registers that
+// have been set. Neighbouring parts are written together and the cache
+// only sends the registers that have changed.
+static void writeSynthParts( struct sOscDevice *pDev, const uint8_t *pSynth, uint16_t parts )
+{
+    uint8_t start = 0;
+
+    for( uint8_t i = 0 ; i <= NUM_SYNTH_REGS ; i++ )
+    {
+        if( (i == NUM_SYNTH_REGS) || !(parts & (1 << synthPart( SI_SYNTH_PLL_A + i ))) )
+        {
+            if( i > start )
+            {
+                i2cCacheWriteRegisters(pDev->addr, SI_SYNTH_PLL_A + start, &pSynth[start], i - start);
+            }
+            start = i + 1;
+        }
+    }
+}
+
+// Put the register values for a clock's multisynth in the block of
+// PLL and multisynth registers.
+// Returns the parts of the block that have been set
+static uint16_t planMultisynth( struct sOscDevice *pDev, uint8_t clock, uint32_t a, uint32_t b, uint32_t c, uint8_t *pSynth )
+{
+#if NUM_CLOCKS > FIRST_INTEGER_CLOCK
+    if( clock >= FIRST_INTEGER_CLOCK )
+    {
+        // Just the integer divider with the R dividers for both clocks
+        // sharing a register
+        uint8_t *pR = &pSynth[SI_SYNTH_R_DIV_67 - SI_SYNTH_PLL_A];
+
+        pSynth[SI_SYNTH_MS_6 + (clock - FIRST_INTEGER_CLOCK) - SI_SYNTH_PLL_A] = a;
+
+        if( clock == FIRST_INTEGER_CLOCK )
+        {
+            *pR = (*pR & 0xF0) | (pDev->rDiv[clock] >> 4);
+        }
+        else
+        {
+            *pR = (*pR & 0x0F) | pDev->rDiv[clock];
+        }
+
+        return PART_MS(clock) | PART_R_DIV_67;
+    }
+#endif
+
+    calcMultisynth( a, b, c, pDev->rDiv[clock], &pSynth[SI_SYNTH_MS_0 + (8*clock) - SI_SYNTH_PLL_A] );
+
+    return PART_MS(clock);
+}
+
+// Power down a clock that can't be set from its PLL and stop planning for it
+static void planClockOff( struct sOscDevice *pDev, uint8_t clock )
+{
+    pDev->clockFreq[clock] = 0;
+    pDev->planClocks &= ~(1 << clock);
+    pDev->settle.clocks &= ~(1 << clock);
+
+    i2cCacheWriteRegister(pDev->addr, SI_CLK0_CONTROL+clock, 0x80);
+}
+
+// Share out the PLLs and start setting all the clocks.
+// The PLL and multisynth registers are written in one pass and the
+// rest is left in the settle record until they have settled.
+// The register values for imageClock are put in oscPlanImage.
+// Returns false if imageClock can't be set and has been powered down
+static bool oscStartPlan( struct sOscDevice *pDev, uint8_t imageClock )
+{
+    uint8_t  master[NUM_SYNTH_PLL];
+    uint8_t  pllOf[NUM_CLOCKS];
+    uint8_t  synth[NUM_SYNTH_REGS];
+    uint16_t parts = 0;
+    uint32_t divider, pllFreq;
+    uint64_t pllMilliHz;
+    uint32_t a, b, c;
+    bool     bQuadrature;
+    bool     bImage = false;
+    uint8_t  pll, clock;
+
+#if NUM_CLOCKS > 1
+    // In quadrature set clock 1 frequency to the same as clock 0
+    if( pDev->quadrature )
+    {
+        pDev->clockFreq[1] = pDev->clockFreq[0];
+        pDev->clockMilliHz[1] = pDev->clockMilliHz[0];
+        pDev->clockExact[1] = pDev->clockExact[0];
+        pDev->rDiv[1] = pDev->rDiv[0];
+    }
+#endif
+    bQuadrature = planQuadrature( pDev );
+
+    oscPlan( pDev, imageClock, master, pllOf );
+
+    // Registers that aren't worked out below keep their values
+    memcpy( synth, pDev->shadowSynth, NUM_SYNTH_REGS );
+
+    for( pll = 0 ; pll < NUM_SYNTH_PLL ; pll++ )
+    {
+        uint8_t m = master[pll];
+
+        if( m == NO_CLOCK )
+        {
+            continue;
+        }
+
+        divider = planDivider( pDev, pll, m, bQuadrature && (m == 0) );
+        pDev->pllDivider[pll] = divider;
+
+        pllFreq = calcFreqPLL( pDev, pDev->clockFreq[m], pDev->clockMilliHz[m], pDev->clockExact[m], divider,
+                               &synth[synthPLL[pll] - SI_SYNTH_PLL_A], &pllMilliHz );
+        parts |= PART_PLL(pll);
+
+        // Register 7 latches in the new values so is always written
+        i2cCacheInvalidateRegister(pDev->addr, synthPLL[pll] + 7);
+
+        for( clock = 0 ; clock < NUM_CLOCKS ; clock++ )
+        {
+            if( !planActive( pDev, clock ) || (pllOf[clock] != pll) )
+            {
+                continue;
+            }
+
+            if( (clock == m) || (bQuadrature && (clock == 1)) )
+            {
+                a = divider;
+                b = 0;
+                c = 1;
+            }
+            else if( clock >= FIRST_INTEGER_CLOCK )
+            {
+                uint32_t r;
+
+                // When no plan suits every clock this one may not get
+                // an even integer divider from 6 to 254
+                if( planClockCost( pDev, clock, pllFreq, pDev->clockMilliHz[m] == 0 ) >= PLAN_COST_WRONG )
                 {
-                    calcDivider( clockFreq[1], pllFreq[SYNTH_PLL_A], &a1, &b1, &c1 );
+                    planClockOff( pDev, clock );
+                    continue;
                 }
+
+                a = divSmall( pllFreq, pDev->clockFreq[clock], 10, &r );
+                b = 0;
+                c = 1;
             }
             else
             {
-                // Clock 1 is the higher frequency so get its integer divider
-                // In quadrature mode won't get here as the oscillator frequencies are equal
-                a1 = getMultisynthDivider( clockFreq[1], false );
-                b1 = 0;
-                c1 = 1;
+                calcFreqDivider( pDev->clockFreq[clock], pDev->clockMilliHz[clock], pDev->clockExact[clock],
+                                 pllFreq, pllMilliHz, &a, &b, &c );
+            }
+
+            // Above 150MHz clocks 6 and 7 can't set a PLL either
+            if( (clock >= FIRST_INTEGER_CLOCK) && (a < 6) )
+            {
+                planClockOff( pDev, clock );
+                continue;
+            }
+
+            parts |= planMultisynth( pDev, clock, a, b, c, synth );
+
+            if( clock == imageClock )
+            {
+                bImage = true;
+                memcpy( oscPlanImage.pll, &synth[synthPLL[pll] - SI_SYNTH_PLL_A], NUM_PLL_BYTES );
+                calcMultisynth( a, b, c, pDev->rDiv[clock], oscPlanImage.ms[0] );
+                memcpy( oscPlanImage.ms[1], oscPlanImage.ms[0], NUM_MS_BYTES );
+                oscPlanImage.a = divider;
+            }
+
+            // Reset the PLL if its divider has changed or the clock has moved to it.
+            // For small changes to the parameters there is no need and no glitch.
+            if( (divider != pDev->prevDivider[clock]) ||
+                ((pDev->planClocks & (1 << clock)) && (pDev->clockPLL[clock] != pll)) )
+            {
+                pDev->settle.pllReset |= (pll == SYNTH_PLL_B) ? SI_PLL_RESET_B : SI_PLL_RESET_A;
+                pDev->prevDivider[clock] = divider;
+            }
+
+            pDev->clockPLL[clock] = pll;
+            pDev->planClocks |= (1 << clock);
+
+            // Switch on the clock from the right PLL
+            pDev->settle.clocks |= (1 << clock);
+        }
+    }
+
+    // Set quadrature mode if applicable (only for clock 0 or clock 1)
+    if( pDev->planClocks & 0x03 )
+    {
+        pDev->settle.phoff[0] = 0;
+        pDev->settle.phoff[1] = 0;
+
+        if( bQuadrature )
+        {
+            if( pDev->quadrature < 0 )
+            {
+                pDev->settle.phoff[1] = pDev->pllDivider[pDev->clockPLL[0]];
+            }
+            else
+            {
+                pDev->settle.phoff[0] = pDev->pllDivider[pDev->clockPLL[0]];
+            }
+        }
+        pDev->settle.bPhoff = true;
+    }
+
+    writeSynthParts( pDev, synth, parts );
+
+    // Delay needed for it to take changes
+    oscSettleStart( pDev );
+
+    return bImage;
+}
+
+// Start setting the clock to the given frequency with optional quadrature.
+// All the clocks are planned again which may move them between the PLLs.
+// Returns the register values for the clock or null if the clock is invalid
+// or can't be set alongside the others
+static const struct sOscImage *oscStartFrequency( struct sOscDevice *pDev, uint8_t clock, uint32_t frequency, uint16_t milliHz, bool bExact, int8_t q )
+{
+    const struct sOscImage *pImage = 0;
+
+    if( clock < NUM_CLOCKS )
+    {
+        oscRecordFrequency( pDev, clock, frequency, milliHz, bExact, q );
+        if( oscStartPlan( pDev, clock ) )
+        {
+            pImage = &oscPlanImage;
+        }
+    }
+
+    return pImage;
+}
+#else
+
+// Work out the registers for a PLL and its multisynths from the recorded
+// clock frequencies. clocks has a bit set for each clock being changed.
+// If pSynth is null the registers are written now, otherwise they are
+// copied into pSynth which holds the whole block of PLL and multisynth
+// registers starting at SI_SYNTH_PLL_A.
+// The rest is left in the settle record until they have settled.
+// Returns the register values
+static const struct sOscImage *oscStartPLL( struct sOscDevice *pDev, uint8_t pll, uint8_t clocks, uint8_t *pSynth )
+{
+    // What the register values depend on and the values themselves
+    struct sOscImageKey key;
+    const struct sOscImage *pImage;
+
+    // The PLL reset bit
+    uint8_t pll_reset;
+
+    // The first clock on the PLL
+    uint8_t firstClock;
+
+    memset( &key, 0, sizeof(key) );
+    key.pDev = pDev;
+
+#if NUM_CLOCKS > 2
+    if( pll == SYNTH_PLL_B )
+    {
+        pll_reset = SI_PLL_RESET_B;
+        firstClock = 2;
+
+        key.freq[0] = pDev->clockFreq[2];
+        key.milliHz[0] = pDev->clockMilliHz[2];
+        key.bExact[0] = pDev->clockExact[2];
+        key.rDiv[0] = pDev->rDiv[2];
+        key.bPllB = true;
+
+        // The integer divider for the clock that sets the PLL
+        key.divider = getMultisynthDivider( pDev, SYNTH_PLL_B, key.freq[0], false );
+    }
+    else
+#endif
+    {
+        // Clocks 0 and 1 share PLL A so both frequencies
+        // determine the dividers.
+        // We will always set clock 0 first
+        pll_reset = SI_PLL_RESET_A;
+        firstClock = 0;
+
+        key.freq[0] = pDev->clockFreq[0];
+        key.milliHz[0] = pDev->clockMilliHz[0];
+        key.bExact[0] = pDev->clockExact[0];
+        key.rDiv[0] = pDev->rDiv[0];
+
+#if NUM_CLOCKS > 1
+        // In quadrature set clock 1 frequency to the same as clock 0
+        if( pDev->quadrature )
+        {
+            pDev->clockFreq[1] = pDev->clockFreq[0];
+            pDev->clockMilliHz[1] = pDev->clockMilliHz[0];
+            pDev->clockExact[1] = pDev->clockExact[0];
+            pDev->rDiv[1] = pDev->rDiv[0];
+        }
+
+        key.freq[1] = pDev->clockFreq[1];
+        key.milliHz[1] = pDev->clockMilliHz[1];
+        key.bExact[1] = pDev->clockExact[1];
+        key.rDiv[1] = pDev->rDiv[1];
+        key.bQuadrature = (pDev->quadrature != 0);
+#endif
+
+        // The integer divider for the clock that sets the PLL
+        // which is the one with the higher frequency
+        key.divider = getMultisynthDivider( pDev, SYNTH_PLL_A, key.freq[keyClock0Higher( &key ) ? 0 : 1], key.bQuadrature );
+    }
+
+    // Work out the register values unless they are cached
+    pImage = oscGetImage( &key );
+
+    if( pSynth )
+    {
+        memcpy( &pSynth[synthPLL[pll] - SI_SYNTH_PLL_A], pImage->pll, NUM_PLL_BYTES );
+        memcpy( &pSynth[SI_SYNTH_MS_0 + (8*firstClock) - SI_SYNTH_PLL_A], pImage->ms[0],
+                ((firstClock == 0) ? NUM_PLL_A_CLOCKS : 1) * NUM_MS_BYTES );
+    }
+    else
+    {
+        // Set up the PLL
+        setupPLL( pDev, pll, pImage->pll );
+
+        // Set up the multiSynth divider, with the calculated divider.
+        // The final R division stage can divide by a power of two, from 1..128.
+        // represented by constants SI_R_DIV1 to SI_R_DIV128 (see si5351a.h header file)
+        // If you want to output frequencies below 1MHz, you have to use the
+        // final R division stage
+        // Clocks 0 and 1 both use PLL A so their consecutive multisynths
+        // are set together.
+        setupMultisynth(pDev, SI_SYNTH_MS_0+(8*firstClock), pImage->ms[0], (firstClock == 0) ? NUM_PLL_A_CLOCKS : 1);
+    }
+
+    // Set quadrature mode if applicable (only for clock 0 or clock 1)
+    if( pll == SYNTH_PLL_A )
+    {
+        pDev->settle.phoff[0] = 0;
+        pDev->settle.phoff[1] = 0;
+
+        if( pDev->quadrature < 0)
+        {
+            pDev->settle.phoff[1] = pImage->a;
+        }
+        else if( pDev->quadrature > 0)
+        {
+            pDev->settle.phoff[0] = pImage->a;
+        }
+        pDev->settle.bPhoff = true;
+    }
+
+    for( uint8_t clock = 0 ; clock < NUM_CLOCKS ; clock++ )
+    {
+        if( clocks & (1 << clock) )
+        {
+            // Switch on the clock
+            pDev->settle.clocks |= (1 << clock);
+
+            // If the divider has changed then set everything up
+            // This will usually only happen at power up
+            // but will also happen if the frequency changes enough
+            if( pImage->a != pDev->prevDivider[clock] )
+            {
+                // Reset the PLLs. This causes a glitch in the output. For small changes to
+                // the parameters, you don't need to reset the PLL, and there is no glitch
+                pDev->settle.pllReset |= pll_reset;
+
+                pDev->prevDivider[clock] = pImage->a;
+            }
+        }
+    }
+
+    // Delay needed for it to take changes
+    oscSettleStart( pDev );
+
+    return pImage;
+}
+
+// Start setting the clock to the given frequency with optional quadrature.
+// The PLL and multisynths are written now and the rest is left
+// in the settle record until they have settled.
+// Returns the register values or null if the clock is invalid
+static const struct sOscImage *oscStartFrequency( struct sOscDevice *pDev, uint8_t clock, uint32_t frequency, uint16_t milliHz, bool bExact, int8_t q )
+{
+    const struct sOscImage *pImage = 0;
+
+    if( clock < NUM_CLOCKS )
+    {
+        oscRecordFrequency( pDev, clock, frequency, milliHz, bExact, q );
+        pImage = oscStartPLL( pDev, (clock == 2) ? SYNTH_PLL_B : SYNTH_PLL_A, 1 << clock, 0 );
+    }
+
+    return pImage;
+}
+#endif // OSC_PLANNER
+
+// Finish the frequency changes once the multisynths have settled
+static void oscFinishFrequency( struct sOscDevice *pDev )
+{
+    if( pDev->settle.bPhoff )
+    {
+        i2cCacheWriteRegisters(pDev->addr, SI_CLK0_PHOFF, pDev->settle.phoff, NUM_PHOFF_REGS);
+    }
+
+    for( uint8_t clock = 0 ; clock < NUM_CLOCKS ; clock++ )
+    {
+        if( pDev->settle.clocks & (1 << clock) )
+        {
+            i2cCacheWriteRegister(pDev->addr, SI_CLK0_CONTROL+clock,
+                                  0x4F | ((oscClockPLL( pDev, clock ) == SYNTH_PLL_B) ? SI_CLK_SRC_PLL_B : SI_CLK_SRC_PLL_A));
+        }
+    }
+
+    if( pDev->settle.pllReset )
+    {
+        i2cWriteRegister(pDev->addr, SI_PLL_RESET, pDev->settle.pllReset);
+    }
+
+    pDev->settle.bPending = false;
+    pDev->settle.bPhoff = false;
+    pDev->settle.clocks = 0;
+    pDev->settle.pllReset = 0;
+}
+
+// Set the clock to the given frequency with optional quadrature
+// and wait for it to take effect
+void oscDevSetFrequency( struct sOscDevice *pDev, uint8_t clock, uint32_t frequency, int8_t q )
+{
+    oscStartFrequency( pDev, clock, frequency, 0, false, q );
+
+    // Delay needed for it to take changes
+    delay(1);
+
+    oscFinishFrequency( pDev );
+}
+
+// Set several clocks at once
+// All the frequencies are noted before the PLLs are worked out so each
+// PLL is set up once. When both PLLs change their registers and those of
+// the multisynths are one block which is written in one pass.
+void oscDevSetFrequencies( struct sOscDevice *pDev, const struct sOscRequest *pReqs, uint8_t n )
+{
+    // Bit set for each clock being changed
+    uint8_t clocks = 0;
+
+#ifndef OSC_PLANNER
+    // The whole block of PLL and multisynth registers
+    uint8_t synth[NUM_SYNTH_REGS];
+#endif
+
+    for( uint8_t i = 0 ; i < n ; i++ )
+    {
+        if( pReqs[i].clock < NUM_CLOCKS )
+        {
+            oscRecordFrequency( pDev, pReqs[i].clock, pReqs[i].frequency, 0, false, pReqs[i].q );
+            clocks |= (1 << pReqs[i].clock);
+        }
+    }
+
+#ifdef OSC_PLANNER
+    // The planner sets all the clocks in one pass
+    if( clocks )
+    {
+        oscStartPlan( pDev, NO_CLOCK );
+    }
+#else
+    if( (clocks & 0x03) && (clocks & 0x04) )
+    {
+        oscStartPLL( pDev, SYNTH_PLL_A, clocks & 0x03, synth );
+        oscStartPLL( pDev, SYNTH_PLL_B, clocks & 0x04, synth );
+
+        // Register 7 of each PLL latches in its new values so is always written
+        i2cCacheInvalidateRegister(pDev->addr, SI_SYNTH_PLL_A + 7);
+        i2cCacheInvalidateRegister(pDev->addr, SI_SYNTH_PLL_B + 7);
+        i2cCacheWriteRegisters(pDev->addr, SI_SYNTH_PLL_A, synth, NUM_SYNTH_REGS);
+    }
+    else if( clocks & 0x03 )
+    {
+        oscStartPLL( pDev, SYNTH_PLL_A, clocks, 0 );
+    }
+    else if( clocks )
+    {
+        oscStartPLL( pDev, SYNTH_PLL_B, clocks, 0 );
+    }
+#endif
 
-                // Set up the PLL
-                setupPLL(SYNTH_PLL_A, a1, clockFreq[1]);
+    if( clocks )
+    {
+        // Delay needed for it to take changes
+        delay(1);
 
-                // Work out the required divider for clock 0
-                calcDivider( clockFreq[0], pllFreq[SYNTH_PLL_A], &a, &b, &c );
-            }
-            pll_reset = SI_PLL_RESET_A;
-            pll_clock = SI_CLK_SRC_PLL_A;
-        }
+        // Switches on the clocks and resets both PLLs with one write
+        oscFinishFrequency( pDev );
+    }
+}
 
-        // Set up the multiSynth divider, with the calculated divider.
-        // The final R division stage can divide by a power of two, from 1..128.
-        // represented by constants SI_R_DIV1 to SI_R_DIV128 (see si5351a.h header file)
-        // If you want to output frequencies below 1MHz, you have to use the
-        // final R division stage
-        setupMultisynth(SI_SYNTH_MS_0+(8*firstClock), a, b, c, rDiv[firstClock]);
+// Set the clock to the given frequency in millihertz using the
+// closest fractions for the dividers and wait for it to take effect
+// Returns the frequency achieved in millihertz or 0 if the clock is invalid
+uint64_t oscDevSetFrequencyMilliHz( struct sOscDevice *pDev, uint8_t clock, uint64_t frequency, int8_t q )
+{
+    const struct sOscImage *pImage;
+    uint64_t achieved = 0;
+    uint64_t milliHz;
+    uint32_t freq;
+
+    // Far beyond the chip's range and the hertz would not fit in 32 bits
+    if( (frequency >> 32) >= 1000 )
+    {
+        return 0;
+    }
+    freq = divSmall64( frequency, 1000, 32, &milliHz );
+
+    pImage = oscStartFrequency( pDev, clock, freq, milliHz, true, q );
+
+    if( pImage )
+    {
+        // Clock 1 uses the second multisynth on PLL A
+        achieved = decodeFrequency( pDev, pImage->pll, pImage->ms[(clock == 1) ? 1 : 0] );
 
         // Delay needed for it to take changes
         delay(1);
 
-        // Set quadrature mode if applicable (only for clock 0 or clock 1)
-        if( clock != 2 )
+        oscFinishFrequency( pDev );
+    }
+
+    return achieved;
+}
+
+#ifdef OSC_FSK
+// Maximum number of tones
+#ifndef OSC_FSK_MAX_TONES
+#define OSC_FSK_MAX_TONES 8
+#endif
+
+// The FSK tones and the symbols being sent
+static struct
+{
+    struct sOscDevice *pDev;        // Device sending the symbols
+    uint8_t  tones[OSC_FSK_MAX_TONES][NUM_PLL_BYTES];   // PLL registers for each tone
+    uint8_t  numTones;              // Number of tones set up
+    uint8_t  first;                 // First PLL register that differs between the tones
+    uint8_t  reg;                   // Its register address
+    uint8_t  len;                   // Number of registers to write for each symbol
+    const uint8_t *pSymbols;        // Tone for each symbol
+    uint16_t numSymbols;            // Number of symbols
+    uint16_t symbol;                // Current symbol
+    uint16_t periodNum;             // Symbol period is periodNum/periodDen milliseconds
+    uint16_t periodDen;
+    uint16_t ticks;                 // Tick count for the current symbol times periodDen
+    volatile bool bRunning;         // Symbols are being sent
+#ifndef I2C_ASYNC
+    volatile uint8_t dueTone;       // Tone to write from oscPoll() plus 1 or 0 for none
+#endif
+} oscFsk;
+
+#ifdef I2C_ASYNC
+// Transaction queued from the timer interrupt
+static struct sI2CTransaction oscFskTrans;
+#endif
+
+// Precompute the PLL registers for each FSK tone and set the clock to the first
+//
+// All the tones use the same PLL denominator P3 which is chosen so the
+// tone spacing is a whole number of steps of the numerator. Only P1 and
+// P2 then change between the tones, usually just the last three registers.
+bool oscDevFskInit( struct sOscDevice *pDev, uint8_t clock, uint64_t frequency, uint32_t spacing, uint8_t numTones )
+{
+    const struct sOscImage *pImage;
+    const uint8_t *ms;
+    uint64_t num;
+    uint32_t c, a, b;
+    uint64_t pllFreq, xtal, delta, step, total;
+    uint32_t stepB, stepC;
+    uint8_t pllReg, shift;
+    uint8_t i, j;
+
+    if( oscFsk.bRunning || (numTones == 0) || (numTones > OSC_FSK_MAX_TONES) )
+    {
+        return false;
+    }
+    oscFsk.pDev = pDev;
+
+    // The first tone is set up in the usual way which also sets the dividers
+    pImage = oscStartFrequency( pDev, clock, frequency / 1000, frequency % 1000, true, 0 );
+    if( pImage == 0 )
+    {
+        return false;
+    }
+
+    ms = pImage->ms[(clock == 1) ? 1 : 0];
+
+    // Actual PLL frequency of the first tone
+    xtal = (uint64_t) pDev->xtalFreq * 1000;
+    c = decodeDivider( pImage->pll, &num );
+    pllFreq = mulDiv( xtal, num, 128 * (uint64_t) c );
+
+    // The PLL moves by the spacing times the multisynth and R dividers
+    c = decodeDivider( ms, &num );
+    shift = (ms[2] >> 4) & 0x07;
+    delta = mulDiv( (uint64_t) spacing << shift, num, 128 * (uint64_t) c );
+
+    // Find the denominator that makes the fraction of the step exact
+    // then scale it up as far as possible for the finest resolution
+    approxFraction( delta % xtal, xtal, &stepB, &stepC );
+    c = MAX_DENOM / stepC * stepC;
+    step = (delta / xtal) * c + (uint64_t) stepB * (c / stepC);
+
+    // The first tone to the nearest step
+    a = pllFreq / xtal;
+    b = ((pllFreq % xtal) * c + xtal / 2) / xtal;
+
+    oscFsk.first = NUM_PLL_BYTES - 1;
+    for( i = 0 ; i < numTones ; i++ )
+    {
+        total = b + step * i;
+        calcMultisynth( a + total / c, total % c, c, SI_R_DIV_1, oscFsk.tones[i] );
+
+        // Register 7 latches the new values so is always written
+        for( j = 0 ; j < oscFsk.first ; j++ )
         {
-            if( quadrature < 0)
+            if( oscFsk.tones[i][j] != oscFsk.tones[0][j] )
             {
-                i2cWriteRegister(SI5351A_I2C_ADDRESS, SI_CLK0_PHOFF, 0);
-                i2cWriteRegister(SI5351A_I2C_ADDRESS, SI_CLK1_PHOFF, a);
+                oscFsk.first = j;
+                break;
             }
-            else if( quadrature > 0)
+        }
+    }
+    pllReg = synthPLL[oscClockPLL( pDev, clock )];
+    oscFsk.reg = pllReg + oscFsk.first;
+    oscFsk.len = NUM_PLL_BYTES - oscFsk.first;
+    oscFsk.numTones = numTones;
+
+#ifdef I2C_ASYNC
+    oscFskTrans.addr = pDev->addr;
+    oscFskTrans.reg = oscFsk.reg;
+    oscFskTrans.len = oscFsk.len;
+    oscFskTrans.bRead = false;
+    oscFskTrans.bNoReg = false;
+    oscFskTrans.priority = I2C_PRIORITY_HIGH;
+    oscFskTrans.callback = 0;
+#endif
+
+    // The first tone with the common denominator replaces the PLL
+    // values just sent. They are written behind the cache's back.
+    i2cWriteRegisters( pDev->addr, pllReg, oscFsk.tones[0], NUM_PLL_BYTES );
+    for( j = 0 ; j < NUM_PLL_BYTES ; j++ )
+    {
+        i2cCacheInvalidateRegister( pDev->addr, pllReg + j );
+    }
+
+    // Delay needed for it to take changes
+    delay(1);
+
+    oscFinishFrequency( pDev );
+
+    return true;
+}
+
+// Write the PLL registers for a tone
+static void oscFskSend( uint8_t tone )
+{
+    if( tone < oscFsk.numTones )
+    {
+#ifdef I2C_ASYNC
+        // If the last tone hasn't been written yet it is skipped
+        if( (oscFskTrans.status != I2C_STATUS_QUEUED) && (oscFskTrans.status != I2C_STATUS_ACTIVE) )
+        {
+            oscFskTrans.buf = &oscFsk.tones[tone][oscFsk.first];
+            i2cQueue( &oscFskTrans );
+        }
+#else
+        oscFsk.dueTone = tone + 1;
+#endif
+    }
+}
+
+#ifndef I2C_ASYNC
+// Write a tone that the timer interrupt has made due
+static void oscFskPoll( void )
+{
+    struct sOscDevice *pDev = oscFsk.pDev;
+
+    uint8_t tone = oscFsk.dueTone;
+
+    if( tone )
+    {
+        oscFsk.dueTone = 0;
+        i2cWriteRegisters( pDev->addr, oscFsk.reg, &oscFsk.tones[tone - 1][oscFsk.first], oscFsk.len );
+    }
+}
+#endif
+
+// Set as the millisecond tick callback while the symbols are sent
+// Moves on to the next symbol at the end of each symbol period
+static void oscFskTick( void )
+{
+    if( oscFsk.bRunning )
+    {
+        oscFsk.ticks += oscFsk.periodDen;
+        if( oscFsk.ticks >= oscFsk.periodNum )
+        {
+            oscFsk.ticks -= oscFsk.periodNum;
+
+            if( ++oscFsk.symbol < oscFsk.numSymbols )
             {
-                i2cWriteRegister(SI5351A_I2C_ADDRESS, SI_CLK0_PHOFF, a);
-                i2cWriteRegister(SI5351A_I2C_ADDRESS, SI_CLK1_PHOFF, 0);
+                oscFskSend( oscFsk.pSymbols[oscFsk.symbol] );
             }
             else
             {
-                i2cWriteRegister(SI5351A_I2C_ADDRESS, SI_CLK0_PHOFF, 0);
-                i2cWriteRegister(SI5351A_I2C_ADDRESS, SI_CLK1_PHOFF, 0);
+                oscFsk.bRunning = false;
+                millisSetTickCallback( 0 );
             }
         }
+    }
+}
 
-        // Switch on the clock
-        i2cWriteRegister(SI5351A_I2C_ADDRESS, SI_CLK0_CONTROL+clock, 0x4F | pll_clock);
+// Start sending the symbols
+bool oscFskStart( const uint8_t *pSymbols, uint16_t numSymbols, uint16_t periodNum, uint16_t periodDen )
+{
+    if( oscFsk.bRunning || (oscFsk.numTones == 0) || (numSymbols == 0) || (periodDen == 0) )
+    {
+        return false;
+    }
 
-        // If we are setting clock 0 then we need to also set the multisynth divider for
-        // clock 1 because it also uses PLL A
-        if( firstClock == 0 )
-        {
-            setupMultisynth(SI_SYNTH_MS_1, a1, b1, c1, rDiv[1]);
+    oscFsk.pSymbols = pSymbols;
+    oscFsk.numSymbols = numSymbols;
+    oscFsk.periodNum = periodNum;
+    oscFsk.periodDen = periodDen;
+    oscFsk.symbol = 0;
+    oscFsk.ticks = 0;
 
-            delay(1);
-        }
+    oscFskSend( pSymbols[0] );
 
-        // If the divider has changed then set everything up
-        // This will usually only happen at power up
-        // but will also happen if the frequency changes enough
-        if( a != prevDivider[clock] )
-        {
-            // Reset the PLLs. This causes a glitch in the output. For small changes to
-            // the parameters, you don't need to reset the PLL, and there is no glitch
-            i2cWriteRegister(SI5351A_I2C_ADDRESS, SI_PLL_RESET, pll_reset);
+    // The timer interrupt takes over from here
+    oscFsk.bRunning = true;
+    millisSetTickCallback( oscFskTick );
 
-            prevDivider[clock] = a;
-        }
+    return true;
+}
+
+// Stop sending the symbols
+void oscFskStop( void )
+{
+    oscFsk.bRunning = false;
+    millisSetTickCallback( 0 );
+}
+
+// Find out if the symbols are still being sent
+bool oscFskBusy( void )
+{
+    return oscFsk.bRunning;
+}
+
+#endif
+
+#ifdef OSC_SWEEP
+// The sweep in progress
+static struct
+{
+    struct sOscDevice *pDev;    // Device being swept
+    uint8_t  clock;             // Clock being swept
+    uint8_t  pll;               // Its PLL
+    uint32_t frequency;         // Current frequency after the R divider
+    int32_t  step;              // Step after the R divider
+    uint16_t stepsLeft;         // Steps still to go
+    uint32_t divider;           // Multisynth divider for the current part of the sweep
+} oscSweep;
+
+// Choose the multisynth divider for the rest of the sweep and set it up
+// along with the PLL for the current frequency, resetting the PLL.
+static void oscSweepSetup( void )
+{
+    struct sOscDevice *pDev = oscSweep.pDev;
+
+    uint8_t regs[NUM_PLL_BYTES];
+    uint32_t fEnd = oscSweep.frequency + oscSweep.step * (int32_t) oscSweep.stepsLeft;
+    uint32_t fLow, fHigh;
+    uint32_t divider;
+
+    if( oscSweep.step < 0 )
+    {
+        fLow = fEnd;
+        fHigh = oscSweep.frequency;
+    }
+    else
+    {
+        fLow = oscSweep.frequency;
+        fHigh = fEnd;
+    }
+
+    // Use the largest even divider that keeps the VCO in range at the
+    // high end. If the rest of the sweep is too wide for one divider then
+    // going up start at the bottom of the VCO range instead. The divider
+    // is changed again when the VCO leaves the range.
+    divider = (OSC_VCO_MAX / fHigh) & ~1UL;
+    if( (uint64_t) fLow * divider < OSC_VCO_MIN && oscSweep.step > 0 )
+    {
+        divider = ((OSC_VCO_MIN + fLow - 1) / fLow + 1) & ~1UL;
+    }
+
+    if( divider > 900 )
+    {
+        divider = 900;
+    }
+    else if( divider < 4 )
+    {
+        divider = 4;
+    }
+    oscSweep.divider = divider;
+    pDev->prevDivider[oscSweep.clock] = divider;
+
+    calcPLL( pDev, divider, oscSweep.frequency, regs );
+    setupPLL( pDev, oscSweep.pll, regs );
+    calcMultisynth( divider, 0, 1, pDev->rDiv[oscSweep.clock], regs );
+    setupMultisynth( pDev, SI_SYNTH_MS_0 + (8 * oscSweep.clock), regs, 1 );
+
+    pDev->settle.clocks |= (1 << oscSweep.clock);
+    pDev->settle.pllReset |= (oscSweep.pll == SYNTH_PLL_B) ? SI_PLL_RESET_B : SI_PLL_RESET_A;
+
+    // Delay needed for it to take changes
+    delay(1);
+
+    oscFinishFrequency( pDev );
+}
+
+// Start a frequency sweep
+bool oscDevSweepStart( struct sOscDevice *pDev, uint8_t clock, uint32_t fStart, int32_t fStep, uint16_t nSteps )
+{
+    int64_t fEnd = fStart + (int64_t) fStep * nSteps;
+    uint32_t fLow, fHigh;
+    uint8_t shift;
+
+    if( (clock >= NUM_CLOCKS) || (clock >= FIRST_INTEGER_CLOCK) || (fEnd <= 0) || (fEnd > UINT32_MAX) )
+    {
+        return false;
+    }
+
+    if( fStep < 0 )
+    {
+        fLow = fEnd;
+        fHigh = fStart;
+    }
+    else
+    {
+        fLow = fStart;
+        fHigh = fEnd;
+    }
+
+    // The R divider is chosen for the low end and kept for the whole sweep
+    pDev->rDiv[clock] = getRDiv( &fLow );
+    shift = pDev->rDiv[clock] >> 4;
+
+    // The smallest divider must be able to reach the high end
+    if( ((uint64_t) fHigh << shift) > OSC_VCO_MAX / 4 )
+    {
+        return false;
+    }
+
+    oscSweep.pDev = pDev;
+    oscSweep.clock = clock;
+    oscSweep.pll = oscClockPLL( pDev, clock );
+    oscSweep.frequency = fStart << shift;
+    oscSweep.step = fStep * (1L << shift);
+    oscSweep.stepsLeft = nSteps;
+
+    // Keep track of the clock for when the other clock on PLL A is set
+    pDev->clockFreq[clock] = oscSweep.frequency;
+    pDev->clockMilliHz[clock] = 0;
+    pDev->clockExact[clock] = false;
+
+    oscSweepSetup();
+
+    return true;
+}
+
+// Move the sweep on one step
+bool oscSweepNext( void )
+{
+    struct sOscDevice *pDev = oscSweep.pDev;
+
+    uint8_t regs[NUM_PLL_BYTES];
+    uint64_t vco;
+
+    if( oscSweep.stepsLeft == 0 )
+    {
+        return false;
+    }
+
+    oscSweep.stepsLeft--;
+    oscSweep.frequency += oscSweep.step;
+    pDev->clockFreq[oscSweep.clock] = oscSweep.frequency;
+
+    vco = (uint64_t) oscSweep.frequency * oscSweep.divider;
+    if( (vco < OSC_VCO_MIN) || (vco > OSC_VCO_MAX) )
+    {
+        // Need a new divider for the rest of the sweep
+        oscSweepSetup();
+    }
+    else
+    {
+        // Only the PLL changes and only its changed registers are sent
+        calcPLL( pDev, oscSweep.divider, oscSweep.frequency, regs );
+        setupPLL( pDev, oscSweep.pll, regs );
+    }
+
+    return true;
+}
+#endif
+
+// Start setting the clock to the given frequency
+// oscPoll() finishes the change
+void oscDevSetFrequencyAsync( struct sOscDevice *pDev, uint8_t clock, uint32_t frequency, int8_t q )
+{
+    oscStartFrequency( pDev, clock, frequency, 0, false, q );
+}
+
+// Finish any frequency change once the settle time has passed
+// Returns true if a change is still in progress
+bool oscDevPoll( struct sOscDevice *pDev )
+{
+#if defined OSC_FSK && !defined I2C_ASYNC
+    oscFskPoll();
+#endif
+
+    if( pDev->settle.bPending && ((int32_t)(micros() - pDev->settle.deadline) >= 0) )
+    {
+        oscFinishFrequency( pDev );
     }
+
+    return pDev->settle.bPending;
 }
 
 
 // Set the crystal frequency.
-void oscSetXtalFrequency( uint32_t xtal_freq )
+void oscDevSetXtalFrequency( struct sOscDevice *pDev, uint32_t xtal_freq )
 {
-    xtalFreq = xtal_freq;
+    pDev->xtalFreq = xtal_freq;
+    pDev->pllDenom = xtal_freq / DENOM_RATIO;
+
+#if OSC_IMAGE_CACHE_LEN > 0
+    // The cached register values were for the old crystal frequency
+    numOscImages = 0;
+#endif
 }
 
-// Initialise the si5351a chip
+// Set up one of a device's register caches and add it
+static void oscAddCache( struct sOscDevice *pDev, struct sI2CCache *pCache, uint8_t firstReg, uint8_t numRegs, uint8_t *regs, uint8_t *valid )
+{
+    pCache->addr = pDev->addr;
+    pCache->firstReg = firstReg;
+    pCache->numRegs = numRegs;
+    pCache->bRegisterless = false;
+    pCache->regs = regs;
+    pCache->valid = valid;
+    i2cCacheAdd( pCache );
+}
+
+// Set up the device and wait for the chip to be ready
 // Returns true if successful
 // Returns false if unable to talk to it or it doesn't initialise properly
-bool oscInit( void )
+static bool oscDevStart( struct sOscDevice *pDev, uint8_t addr )
 {
-    int i;
+    uint32_t start;
+    uint32_t reads = OSC_INIT_TIMEOUT_US / OSC_INIT_READ_US;
     uint8_t regVal;
-    
-    // We talk to the chip over I2C
-    i2cInit();
 
-    // Wait for the device to be ready
-    for( i = 0 ; i < MAX_INIT_TRIES ; i++ )
+    pDev->addr = addr;
+#ifdef OSC_PLANNER
+    pDev->planMaster[SYNTH_PLL_A] = NO_CLOCK;
+    pDev->planMaster[SYNTH_PLL_B] = NO_CLOCK;
+#endif
+
+    // The chip can run faster than other devices on the bus
+#ifdef SI5351A_I2C_CLOCK_RATE
+    i2cSetDeviceClock( pDev->addr, SI5351A_I2C_CLOCK_RATE );
+#endif
+
+    // The chip may have been reset so forget any previous register values
+    oscAddCache( pDev, &pDev->cacheEnable,  SI_CLK_ENABLE,   1,              pDev->shadowEnable,  pDev->validEnable );
+    oscAddCache( pDev, &pDev->cacheControl, SI_CLK0_CONTROL, NUM_CLOCKS,     pDev->shadowControl, pDev->validControl );
+    oscAddCache( pDev, &pDev->cacheSynth,   SI_SYNTH_PLL_A,  NUM_SYNTH_REGS, pDev->shadowSynth,   pDev->validSynth );
+    oscAddCache( pDev, &pDev->cachePhoff,   SI_CLK0_PHOFF,   NUM_PHOFF_REGS, pDev->shadowPhoff,   pDev->validPhoff );
+    i2cCacheInvalidate( pDev->addr );
+
+    // Wait for the device to be ready by polling the device status
+    // register until the system init bit clears
+    start = micros();
+    do
     {
-        // Poll the device status register until the system init bit clears
-        if( (i2cReadRegister( SI5351A_I2C_ADDRESS, SI_DEVICE_STATUS, &regVal ) == 0) &&
+        if( (i2cReadRegister( pDev->addr, SI_DEVICE_STATUS, &regVal ) == 0) &&
             !(regVal & SYS_INIT) )
         {
-            break;
+            return true;
         }
-    }
+    } while( (--reads > 0) && ((micros() - start) < OSC_INIT_TIMEOUT_US) );
 
-    // See if we have timed out
-    if( i == MAX_INIT_TRIES )
+    // Timed out
+    return false;
+}
+
+// Initialise the si5351a chip
+// Returns true if successful
+// Returns false if unable to talk to it or it doesn't initialise properly
+bool oscDevInit( struct sOscDevice *pDev, uint8_t addr )
+{
+    if( !oscDevStart( pDev, addr ) )
     {
         return false;
     }
@@ -675,16 +2471,172 @@ bool oscInit( void )
         // They will be enabled when the frequency is set.
         //
         // Disable all the outputs
-        si5351aOutputEnable( SI_CLK_ENABLE_0 | SI_CLK_ENABLE_1 | SI_CLK_ENABLE_2, false );
+        si5351aOutputEnable( pDev, (1 << NUM_CLOCKS) - 1, false );
 
         // Power down all the output drivers
-        si5351aOutputOff(SI_CLK0_CONTROL);
-        si5351aOutputOff(SI_CLK1_CONTROL);
-        si5351aOutputOff(SI_CLK2_CONTROL);
+        si5351aOutputsOff( pDev, NUM_CLOCKS );
 
         // Set the crystal load capacitance
-        i2cWriteRegister( SI5351A_I2C_ADDRESS, SI_XTAL_LOAD, SI_XTAL_LOAD_CAP );
+        i2cWriteRegister( pDev->addr, SI_XTAL_LOAD, SI_XTAL_LOAD_CAP );
 
         return true;
     }
-}
\ No newline at end of file
+}
+
+// Largest number of registers sent in one transaction by oscDevLoadImage()
+// Uses this much stack.
+#ifndef OSC_LOAD_BURST
+#define OSC_LOAD_BURST 32
+#endif
+
+// Load a register image from program memory following figure 12 of
+// the data sheet: outputs off, write the registers, reset the PLLs and
+// then switch the outputs on.
+// Runs of consecutive registers are sent in bursts.
+// Returns true if successful
+// Returns false if unable to talk to the chip or a write failed
+bool oscDevLoadImage( struct sOscDevice *pDev, uint8_t addr, const uint8_t *pImage )
+{
+    uint8_t buf[OSC_LOAD_BURST];
+    uint8_t first = 0;
+    uint8_t len = 0;
+    const uint8_t *p;
+    uint8_t reg;
+    uint8_t num;
+    uint8_t result = 0;
+
+    // All outputs on unless the image says otherwise
+    uint8_t enable = 0;
+
+    if( !oscDevStart( pDev, addr ) )
+    {
+        return false;
+    }
+
+    // Find the outputs the image enables
+    for( p = pImage ; (reg = pgm_read_byte( p )) != OSC_IMAGE_END ; p += 2 )
+    {
+        if( reg == SI_CLK_ENABLE )
+        {
+            enable = pgm_read_byte( p + 1 );
+        }
+    }
+
+    // Power down our clocks and any above them the image enables as
+    // their drivers may be on from before
+    num = 8;
+    while( (num > NUM_CLOCKS) && (enable & (1 << (num - 1))) )
+    {
+        num--;
+    }
+
+    // Disable all the outputs and power down the output drivers
+    result |= i2cCacheWriteRegister( pDev->addr, SI_CLK_ENABLE, 0xFF );
+    si5351aOutputsOff( pDev, num );
+
+    for( ;; pImage += 2 )
+    {
+        reg = pgm_read_byte( pImage );
+
+        // Send the burst so far if this register doesn't follow on
+        if( (len > 0) && ((reg != first + len) || (len == OSC_LOAD_BURST) || (reg == OSC_IMAGE_END)) )
+        {
+            result |= i2cWriteRegisters( pDev->addr, first, buf, len );
+            len = 0;
+        }
+
+        if( reg == OSC_IMAGE_END )
+        {
+            break;
+        }
+        else if( (reg != SI_CLK_ENABLE) && (reg != SI_PLL_RESET) )
+        {
+            // The enables are held back until the PLLs have been reset
+            if( len == 0 )
+            {
+                first = reg;
+            }
+            buf[len++] = pgm_read_byte( pImage + 1 );
+        }
+    }
+
+    // The shadow copies no longer match the chip
+    i2cCacheInvalidate( pDev->addr );
+
+    // Delay needed for it to take changes
+    delay(1);
+
+    result |= i2cWriteRegister( pDev->addr, SI_PLL_RESET, SI_PLL_RESET_A | SI_PLL_RESET_B );
+    result |= i2cCacheWriteRegister( pDev->addr, SI_CLK_ENABLE, enable );
+
+    return result == 0;
+}
+
+#ifdef SI5351A_I2C_ADDRESS
+// The device used by the functions without a device argument
+static struct sOscDevice oscDefault;
+
+bool oscInit( void )
+{
+    // We talk to the chip over I2C
+    i2cInit();
+
+    return oscDevInit( &oscDefault, SI5351A_I2C_ADDRESS );
+}
+
+bool oscLoadImage( const uint8_t *pImage )
+{
+    i2cInit();
+
+    return oscDevLoadImage( &oscDefault, SI5351A_I2C_ADDRESS, pImage );
+}
+
+void oscSetXtalFrequency( uint32_t xtal_freq )
+{
+    oscDevSetXtalFrequency( &oscDefault, xtal_freq );
+}
+
+void oscSetFrequency( uint8_t clock, uint32_t frequency, int8_t q )
+{
+    oscDevSetFrequency( &oscDefault, clock, frequency, q );
+}
+
+uint64_t oscSetFrequencyMilliHz( uint8_t clock, uint64_t frequency, int8_t q )
+{
+    return oscDevSetFrequencyMilliHz( &oscDefault, clock, frequency, q );
+}
+
+void oscSetFrequencies( const struct sOscRequest *pReqs, uint8_t n )
+{
+    oscDevSetFrequencies( &oscDefault, pReqs, n );
+}
+
+void oscSetFrequencyAsync( uint8_t clock, uint32_t frequency, int8_t q )
+{
+    oscDevSetFrequencyAsync( &oscDefault, clock, frequency, q );
+}
+
+bool oscPoll( void )
+{
+    return oscDevPoll( &oscDefault );
+}
+
+void oscClockEnable( uint8_t clock, bool bEnable )
+{
+    oscDevClockEnable( &oscDefault, clock, bEnable );
+}
+
+#ifdef OSC_FSK
+bool oscFskInit( uint8_t clock, uint64_t frequency, uint32_t spacing, uint8_t numTones )
+{
+    return oscDevFskInit( &oscDefault, clock, frequency, spacing, numTones );
+}
+#endif
+
+#ifdef OSC_SWEEP
+bool oscSweepStart( uint8_t clock, uint32_t fStart, int32_t fStep, uint16_t nSteps )
+{
+    return oscDevSweepStart( &oscDefault, clock, fStart, fStep, nSteps );
+}
+#endif
+#endif
@@ -0,0 +1,214 @@
+/*
+ * bench_osc.c
+ *
+ * Sweeps the Si5351A driver across its frequency range on the
+ * simulated bus. Each frequency set is checked against the register
+ * model in i2c_sim.c and the errors and the bus bytes, transactions
+ * and PLL resets per call are printed for each band.
+ *
+ * Usage: bench_osc [calls per band]
+ *
+ * The sweep is fixed so the table is the same on every run.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <inttypes.h>
+
+#include "config.h"
+#include "i2c.h"
+#include "i2c_sim.h"
+#include "osc.h"
+
+// Crystal frequency used for the sweep
+#define XTAL_FREQ       27000000UL
+
+// The PLL numerator steps in units of xtal / pllDenom which is
+// DENOM_RATIO (27) hertz. The output divider, times the R divider,
+// is at least VCO_MIN / f so the error is no more than this much
+// of the frequency.
+#define PLL_STEP_HZ     27.0
+#define VCO_MIN         600000000.0
+
+// For a frequency set to the millihertz the PLL fraction is the closest
+// with a denominator up to MAX_DENOM so is within half a step of that,
+// divided again by the output divider. The frequency reported back is
+// rounded to the nearest millihertz.
+#define MAX_DENOM           1048575.0
+#define REPORT_MAX_ERROR    0.501
+
+// Default number of calls per band. Seven bands of this many on clock 0
+// are the 2.1M frequency sweep whose table was published with the
+// frequency decoder.
+#define DEFAULT_CALLS   300000
+
+static struct sSi5351Sim si;
+
+// The bands swept
+static const struct
+{
+    uint32_t    lo;
+    uint32_t    hi;
+    const char *name;
+} bands[] =
+{
+    {      8000,    100000, "8k-100k"   },
+    {    100000,   1000000, "100k-1M"   },
+    {   1000000,  10000000, "1M-10M"    },
+    {  10000000,  50000000, "10M-50M"   },
+    {  50000000, 100000000, "50M-100M"  },
+    { 100000000, 150000000, "100M-150M" },
+    { 150000000, 200000000, "150M-200M" },
+};
+
+#define NUM_BANDS   (sizeof(bands) / sizeof(bands[0]))
+
+// Sweep one band on a clock, checking each frequency against the model
+// Returns the number of frequencies out of bounds
+static int sweepBand( uint8_t clock, uint32_t lo, uint32_t hi, const char *name, long calls )
+{
+    const struct sI2CSimStats *pStats = i2cSimGetStats();
+    uint64_t bytes = 0, transactions = 0;
+    uint32_t resets = si.pllResetA + si.pllResetB;
+    double maxError = 0.0, maxBound = 0.0, sumSquares = 0.0;
+    int failed = 0;
+
+    for( long i = 0 ; i < calls ; i++ )
+    {
+        // Step across the band with some jitter so that small and
+        // large changes both happen
+        uint32_t f = lo + (uint64_t)(hi - lo) * i / calls + (i * 7919) % 97;
+        double bound = PLL_STEP_HZ * f / VCO_MIN;
+        double error;
+
+        i2cSimResetStats();
+        oscSetFrequency( clock, f, 0 );
+        bytes += pStats->bytes;
+        transactions += pStats->transactions;
+
+        error = i2cSimSi5351Frequency( &si, clock, XTAL_FREQ ) - f;
+        sumSquares += error * error;
+        if( error < 0 )
+        {
+            error = -error;
+        }
+
+        if( error > bound )
+        {
+            if( failed++ < 5 )
+            {
+                printf( "clock %u at %" PRIu32 "Hz is %.4fHz out, more than %.4fHz\n", clock, f, error, bound );
+            }
+        }
+
+        if( error > maxError )
+        {
+            maxError = error;
+            maxBound = bound;
+        }
+    }
+
+    resets = si.pllResetA + si.pllResetB - resets;
+
+    printf( "%u  %-10s %7ld %11.4f %11.4f %8.4f %10.2f %8.2f %10.4f\n", clock, name, calls, maxError, maxBound,
+            sqrt( sumSquares / calls ), (double) bytes / calls, (double) transactions / calls, (double) resets / calls );
+
+    return failed;
+}
+
+// Set clock 2 to the millihertz near 7MHz and check it against the
+// bound and the frequency reported back
+// Returns the number of frequencies out of bounds
+static int sweepMilliHz( long calls )
+{
+    double maxError = 0.0, sumSquares = 0.0;
+    int failed = 0;
+
+    for( long i = 0 ; i < calls ; i++ )
+    {
+        uint64_t f = 7000000000ULL + i * 1237;
+        double bound = XTAL_FREQ / (2 * MAX_DENOM) * f / VCO_MIN;
+        uint64_t achieved = oscSetFrequencyMilliHz( 2, f, 0 );
+        double actual = i2cSimSi5351Frequency( &si, 2, XTAL_FREQ ) * 1000;
+        double error = actual - f;
+        double reported = actual - achieved;
+
+        sumSquares += error * error;
+
+        if( error < 0 )
+        {
+            error = -error;
+        }
+        if( reported < 0 )
+        {
+            reported = -reported;
+        }
+
+        if( (error > bound) || (reported > REPORT_MAX_ERROR) )
+        {
+            if( failed++ < 5 )
+            {
+                printf( "clock 2 at %" PRIu64 "mHz is %.4fmHz out and %.4fmHz from the %" PRIu64 "mHz reported\n",
+                        f, error, reported, achieved );
+            }
+        }
+
+        if( error > maxError )
+        {
+            maxError = error;
+        }
+    }
+
+    printf( "millihertz on clock 2 near 7MHz: %ld calls, max |error| %.4fmHz, rms %.4fmHz\n",
+            calls, maxError, sqrt( sumSquares / calls ) );
+
+    return failed;
+}
+
+int main( int argc, char **argv )
+{
+    long calls = (argc > 1) ? atol( argv[1] ) : DEFAULT_CALLS;
+    int failed = 0;
+
+    if( calls <= 0 )
+    {
+        printf( "Usage: %s [calls per band]\n", argv[0] );
+        return 2;
+    }
+
+    i2cSimSi5351Init( &si, SI5351A_I2C_ADDRESS );
+    i2cSimAttach( &si.dev );
+    oscSetXtalFrequency( XTAL_FREQ );
+    if( !oscInit() )
+    {
+        printf( "oscInit() failed\n" );
+        return 1;
+    }
+    oscClockEnable( 0, true );
+    oscClockEnable( 2, true );
+
+    printf( "Crystal %luHz, I2C at %luHz\n\n", XTAL_FREQ, (unsigned long) I2C_CLOCK_RATE );
+    printf( "clk range        calls  max|err|Hz    bound Hz   rms Hz bytes/call  tr/call resets/call\n" );
+
+    for( uint8_t clock = 0 ; clock <= 2 ; clock += 2 )
+    {
+        for( uint8_t k = 0 ; k < NUM_BANDS ; k++ )
+        {
+            failed += sweepBand( clock, bands[k].lo, bands[k].hi, bands[k].name, calls );
+        }
+    }
+    printf( "\n" );
+
+    failed += sweepMilliHz( calls );
+
+    if( failed )
+    {
+        printf( "bench_osc: %d failed\n", failed );
+        return 1;
+    }
+
+    printf( "bench_osc: passed\n" );
+    return 0;
+}
@@ -0,0 +1,32 @@
+/*
+ * config.h
+ *
+ * Configuration for the host build of the tests against the
+ * simulated I2C bus.
+ *
+ */
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdbool.h>
+
+#define F_CPU 16000000UL
+
+#define I2C_CLOCK_RATE 400000
+
+#define SI5351A_I2C_ADDRESS 0x60
+#define SI_XTAL_LOAD_CAP 0x92
+
+#ifndef NUM_CLOCKS
+#define NUM_CLOCKS 3
+#endif
+
+// 16x2 LCD on a PCF8574 backpack written by displayUpdate()
+#define LCD_I2C
+#define LCD_I2C_ADDRESS 0x27
+#define LCD_WIDTH 16
+#define LCD_HEIGHT 2
+#define DISPLAY_DEFERRED
+
+#endif //CONFIG_H
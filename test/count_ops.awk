@@ -0,0 +1,23 @@
+# Adds a counter to each division and 64 bit multiply in x86-64
+# assembler from gcc -Os.
+#
+# At -Os gcc divides by a constant with a divide instruction rather than
+# multiplying by the reciprocal so the divisions left are those an AVR
+# build does with the library __udivmodsi4 and __udivmoddi4 calls. A
+# 64 bit multiply by a constant under 256 is taken to be address
+# arithmetic and not counted.
+
+/^\t(div|idiv)l\t/ { print "\tincl\tcountDiv32(%rip)" }
+/^\t(div|idiv)q\t/ { print "\tincl\tcountDiv64(%rip)" }
+/^\t(mul|imul)q\t/ {
+    imm = 0
+    if( match( $0, /\$-?[0-9]+/ ) )
+    {
+        imm = substr( $0, RSTART + 1, RLENGTH - 1 ) + 0
+    }
+    if( (imm == 0) || (imm >= 256) || (imm <= -256) )
+    {
+        print "\tincl\tcountMul64(%rip)"
+    }
+}
+{ print }
@@ -0,0 +1,127 @@
+/*
+ * count_osc.c
+ *
+ * Counts the library arithmetic an AVR build of the Si5351A driver
+ * would call for each frequency set. si5351a.c is built at -Os and
+ * count_ops.awk adds a counter to each division and 64 bit multiply in
+ * its assembler.
+ *
+ * The AVR has no divide instruction and a 32 bit division in the
+ * library takes around 600 cycles and a 64 bit one several thousand so
+ * the 1Hz tuning path is checked to have none.
+ *
+ * Usage: count_osc [calls per band]
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "config.h"
+#include "i2c.h"
+#include "i2c_sim.h"
+#include "osc.h"
+
+// Crystal frequency used for the sweep
+#define XTAL_FREQ       27000000UL
+
+// Default number of calls per band
+#define DEFAULT_CALLS   1000
+
+// Incremented by the instructions added by count_ops.awk
+uint32_t countDiv32, countDiv64, countMul64;
+
+static struct sSi5351Sim si;
+
+// The bands swept
+static const struct
+{
+    uint32_t    lo;
+    uint32_t    hi;
+} bands[] =
+{
+    {      8000,    100000 },
+    {    100000,   1000000 },
+    {   1000000,  10000000 },
+    {  10000000,  50000000 },
+    {  50000000, 100000000 },
+    { 100000000, 150000000 },
+    { 150000000, 200000000 },
+};
+
+#define NUM_BANDS   (sizeof(bands) / sizeof(bands[0]))
+
+static void resetCounts( void )
+{
+    countDiv32 = countDiv64 = countMul64 = 0;
+}
+
+static void printCounts( const char *name, long calls )
+{
+    printf( "%-24s %7ld %10.3f %10.3f %10.3f\n", name, calls,
+            (double) countDiv32 / calls, (double) countDiv64 / calls, (double) countMul64 / calls );
+}
+
+int main( int argc, char **argv )
+{
+    long calls = (argc > 1) ? atol( argv[1] ) : DEFAULT_CALLS;
+    long total = 0;
+    int failed = 0;
+
+    if( calls <= 0 )
+    {
+        printf( "Usage: %s [calls per band]\n", argv[0] );
+        return 2;
+    }
+
+    i2cSimSi5351Init( &si, SI5351A_I2C_ADDRESS );
+    i2cSimAttach( &si.dev );
+    oscSetXtalFrequency( XTAL_FREQ );
+    if( !oscInit() )
+    {
+        printf( "oscInit() failed\n" );
+        return 1;
+    }
+    oscClockEnable( 0, true );
+
+    printf( "path                       calls  div32/call div64/call mul64/call\n" );
+
+    // Small steps and jumps across each band to the hertz
+    resetCounts();
+    for( uint8_t k = 0 ; k < NUM_BANDS ; k++ )
+    {
+        for( long i = 0 ; i < calls ; i++ )
+        {
+            uint32_t f = bands[k].lo + (uint64_t)(bands[k].hi - bands[k].lo) * i / calls + (i * 7919) % 97;
+
+            oscSetFrequency( 0, f, 0 );
+            total++;
+        }
+    }
+    printCounts( "oscSetFrequency()", total );
+
+    if( countDiv32 || countDiv64 )
+    {
+        printf( "count_osc: the 1Hz path made %" PRIu32 " 32 bit and %" PRIu32 " 64 bit divisions\n",
+                countDiv32, countDiv64 );
+        failed++;
+    }
+
+    // The same to the millihertz near 7MHz
+    resetCounts();
+    for( long i = 0 ; i < calls ; i++ )
+    {
+        oscSetFrequencyMilliHz( 0, 7000000000ULL + i * 1237, 0 );
+    }
+    printCounts( "oscSetFrequencyMilliHz()", calls );
+
+    if( failed )
+    {
+        printf( "count_osc: failed\n" );
+        return 1;
+    }
+
+    printf( "count_osc: passed\n" );
+    return 0;
+}
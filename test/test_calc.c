@@ -0,0 +1,251 @@
+/*
+ * test_calc.c
+ *
+ * Checks the shift and subtract division in si5351a.c against the C
+ * operators and the PLL and multisynth register values against the
+ * plain division the driver used before it.
+ *
+ * si5351a.c is included so its static functions can be called.
+ *
+ */
+
+#include "../si5351a.c"
+
+static int failures;
+
+#define CHECK( cond )                                                       \
+    do                                                                      \
+    {                                                                       \
+        if( !(cond) )                                                       \
+        {                                                                   \
+            printf( "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond ); \
+            failures++;                                                     \
+        }                                                                   \
+    } while( 0 )
+
+// Number of random settings checked against the reference
+#define NUM_SETTINGS    60000
+
+// Fixed pseudo random sequence so every run checks the same values
+static uint32_t seed = 12345;
+
+static uint32_t rand32( void )
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+// Random value from lo to hi inclusive
+static uint32_t randRange( uint32_t lo, uint32_t hi )
+{
+    return lo + rand32() % (hi - lo + 1);
+}
+
+// The PLL registers as worked out with plain division
+static void refPLL( uint32_t xtalFreq, uint32_t divider, uint32_t frequency, uint8_t *regs )
+{
+    uint32_t c = xtalFreq / DENOM_RATIO;
+    uint32_t pllFreq = divider * frequency;
+    uint32_t a = pllFreq / xtalFreq;
+    uint32_t b = (pllFreq % xtalFreq) / DENOM_RATIO;
+    uint32_t p = 128 * b / c;
+    uint32_t P1 = 128 * a + p - 512;
+    uint32_t P2 = 128 * b - c * p;
+    uint32_t P3 = c;
+
+    regs[0] = (P3 & 0x0000FF00) >> 8;
+    regs[1] = (P3 & 0x000000FF);
+    regs[2] = (P1 & 0x00030000) >> 16;
+    regs[3] = (P1 & 0x0000FF00) >> 8;
+    regs[4] = (P1 & 0x000000FF);
+    regs[5] = ((P3 & 0x000F0000) >> 12) | ((P2 & 0x000F0000) >> 16);
+    regs[6] = (P2 & 0x0000FF00) >> 8;
+    regs[7] = (P2 & 0x000000FF);
+}
+
+// The multisynth divider a+b/c as worked out with plain division
+static void refDivider( uint32_t clockFreq, uint32_t pllFreq, uint32_t *pa, uint32_t *pb, uint32_t *pc )
+{
+    uint32_t d;
+    uint32_t r = pllFreq % clockFreq;
+
+    *pa = pllFreq / clockFreq;
+
+    if( clockFreq < 21000000 )
+    {
+        d = 21;
+    }
+    else
+    {
+        d = clockFreq / 1000000;
+    }
+
+    *pb = r / d;
+    *pc = clockFreq / d;
+
+    if( *pa >= 900 )
+    {
+        *pa = 900;
+        *pb = 0;
+        *pc = 1;
+    }
+    else if( *pa < 8 )
+    {
+        if( *pa == 7 )
+        {
+            *pa = 8;
+        }
+        else if( *pa == 5 )
+        {
+            *pa = 6;
+        }
+        else
+        {
+            *pa = 4;
+        }
+        *pb = 0;
+        *pc = 1;
+    }
+}
+
+// divSmall() and divSmall64() give the same quotient and remainder as
+// / and % whenever the quotient fits in the given number of bits
+static void testDivSmall( void )
+{
+    for( long i = 0 ; i < NUM_SETTINGS ; i++ )
+    {
+        uint8_t bits = randRange( 1, 31 );
+        uint32_t d = rand32() >> randRange( 1, 31 );
+        uint32_t n = rand32();
+        uint32_t q, rem;
+
+        if( d == 0 )
+        {
+            d = 1;
+        }
+
+        // Bring n into range for the number of bits. d << bits can't
+        // overflow when it is needed.
+        if( (n >> bits) >= d )
+        {
+            n %= d << bits;
+        }
+
+        q = divSmall( n, d, bits, &rem );
+        if( (q != n / d) || (rem != n % d) )
+        {
+            if( failures++ < 5 )
+            {
+                printf( "divSmall( %" PRIu32 ", %" PRIu32 ", %u ) gave %" PRIu32 " rem %" PRIu32 "\n", n, d, bits, q, rem );
+            }
+        }
+    }
+
+    for( long i = 0 ; i < NUM_SETTINGS ; i++ )
+    {
+        uint8_t bits = randRange( 1, 63 );
+        uint64_t d = (((uint64_t) rand32() << 31) ^ rand32()) >> randRange( 0, 62 );
+        uint64_t n = ((uint64_t) rand32() << 32) | rand32();
+        uint64_t q, rem;
+
+        if( d == 0 )
+        {
+            d = 1;
+        }
+
+        if( (n >> bits) >= d )
+        {
+            n %= d << bits;
+        }
+
+        q = divSmall64( n, d, bits, &rem );
+        if( (q != n / d) || (rem != n % d) )
+        {
+            if( failures++ < 5 )
+            {
+                printf( "divSmall64( %" PRIu64 ", %" PRIu64 ", %u ) gave %" PRIu64 " rem %" PRIu64 "\n", n, d, bits, q, rem );
+            }
+        }
+    }
+
+    // The edges the driver relies on
+    uint32_t rem;
+    CHECK( divSmall( 899999999UL, 27000000UL, 8, &rem ) == 33 );
+    CHECK( rem == 8999999UL );
+    CHECK( divSmall( 28000000UL, DENOM_RATIO, 21, &rem ) == 28000000UL / DENOM_RATIO );
+    CHECK( divSmall( 20999999UL, 21, 20, &rem ) == 999999UL );
+    CHECK( rem == 20 );
+}
+
+// The PLL registers are the same as with plain division for crystals
+// from 10MHz to 28MHz across the VCO range
+static void testPLL( void )
+{
+    struct sOscDevice dev;
+
+    memset( &dev, 0, sizeof(dev) );
+
+    for( long i = 0 ; i < NUM_SETTINGS ; i++ )
+    {
+        uint8_t regs[NUM_PLL_BYTES], ref[NUM_PLL_BYTES];
+        uint32_t divider = randRange( 4, 900 );
+        uint32_t frequency = randRange( 600000000UL, 900000000UL ) / divider;
+
+        dev.xtalFreq = (i & 1) ? randRange( 10000000UL, 28000000UL ) : ((i & 2) ? 25000000UL : 27000000UL);
+        dev.pllDenom = dev.xtalFreq / DENOM_RATIO;
+
+        refPLL( dev.xtalFreq, divider, frequency, ref );
+        CHECK( calcPLL( &dev, divider, frequency, regs ) == divider * frequency );
+
+        if( memcmp( regs, ref, sizeof(regs) ) != 0 )
+        {
+            if( failures++ < 5 )
+            {
+                printf( "PLL for %" PRIu32 " x %" PRIu32 "Hz with a %" PRIu32 "Hz crystal differs\n",
+                        divider, frequency, dev.xtalFreq );
+            }
+        }
+    }
+}
+
+// The multisynth divider is the same as with plain division for clocks
+// across the whole range, including those limited to 4, 6, 8 or 900
+static void testDivider( void )
+{
+    for( long i = 0 ; i < NUM_SETTINGS ; i++ )
+    {
+        uint32_t pllFreq = randRange( 600000000UL, 900000000UL );
+        uint32_t clockFreq = pllFreq / randRange( 2, 2048 ) + randRange( 0, 1000000 ) / randRange( 1, 1000 );
+        uint32_t a, b, c, refA, refB, refC;
+
+        calcDivider( clockFreq, pllFreq, &a, &b, &c );
+        refDivider( clockFreq, pllFreq, &refA, &refB, &refC );
+
+        if( (a != refA) || (b != refB) || (c != refC) )
+        {
+            if( failures++ < 5 )
+            {
+                printf( "divider for %" PRIu32 "Hz from %" PRIu32 "Hz is %" PRIu32 "+%" PRIu32 "/%" PRIu32
+                        " not %" PRIu32 "+%" PRIu32 "/%" PRIu32 "\n", clockFreq, pllFreq, a, b, c, refA, refB, refC );
+            }
+        }
+    }
+}
+
+int main( void )
+{
+    testDivSmall();
+    testPLL();
+    testDivider();
+
+    if( failures )
+    {
+        printf( "test_calc: %d failed\n", failures );
+        return 1;
+    }
+
+    printf( "test_calc: passed\n" );
+    return 0;
+}
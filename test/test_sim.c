@@ -0,0 +1,834 @@
+/*
+ * test_sim.c
+ *
+ * Checks the simulated I2C bus and device models and drives the
+ * Si5351A driver over them.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "config.h"
+#include "i2c.h"
+#include "i2c_sim.h"
+#include "millis.h"
+#include "osc.h"
+#include "osc_device.h"
+#include "display.h"
+
+static int failures;
+
+#define CHECK( cond )                                                       \
+    do                                                                      \
+    {                                                                       \
+        if( !(cond) )                                                       \
+        {                                                                   \
+            printf( "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond ); \
+            failures++;                                                     \
+        }                                                                   \
+    } while( 0 )
+
+static struct sSi5351Sim si;
+static struct sLCDSim lcd;
+
+// Crystal frequency of the oscillator model
+#define XTAL_FREQ       27000000UL
+
+// How far a clock is from f in hertz according to the model
+static double clockError( const struct sSi5351Sim *pSi, uint8_t clock, uint32_t xtalFreq, double f )
+{
+    double error = i2cSimSi5351Frequency( pSi, clock, xtalFreq ) - f;
+
+    return (error < 0) ? -error : error;
+}
+
+// The PLL numerator steps in 27Hz and the VCO is at least 600MHz so
+// a clock set to the hertz is within this of the frequency
+#define HZ_BOUND( f )   (27.0 * (f) / 600000000.0 + 0.001)
+
+// Register writes and reads go through to the model
+static void testRegisters( void )
+{
+    const uint8_t data[] = { 1, 2, 3, 4 };
+    uint8_t buf[4];
+    const struct sI2CSimStats *pStats = i2cSimGetStats();
+
+    i2cSimResetStats();
+    CHECK( i2cWriteRegisters( SI5351A_I2C_ADDRESS, 26, data, sizeof(data) ) == 0 );
+    CHECK( memcmp( &si.regs[26], data, sizeof(data) ) == 0 );
+
+    // Address, register and data bytes
+    CHECK( pStats->transactions == 1 );
+    CHECK( pStats->bytes == 2 + sizeof(data) );
+    CHECK( si.dev.bytes == 2 + sizeof(data) );
+
+    CHECK( i2cReadRegisters( SI5351A_I2C_ADDRESS, 26, buf, sizeof(buf) ) == 0 );
+    CHECK( memcmp( buf, data, sizeof(data) ) == 0 );
+
+    // Nothing at this address
+    CHECK( i2cWriteRegister( 0x50, 0, 0 ) != 0 );
+}
+
+// Bus time is added to the simulated time
+static void testTime( void )
+{
+    const struct sI2CSimStats *pStats = i2cSimGetStats();
+    uint32_t start = micros();
+    uint8_t data = 0;
+
+    delay( 5 );
+    CHECK( micros() - start == 5000 );
+
+    // 3 bytes of 9 bits plus start and stop at 400kHz
+    i2cSimResetStats();
+    start = micros();
+    i2cWriteRegister( SI5351A_I2C_ADDRESS, 3, data );
+    CHECK( pStats->busTime > 60 && pStats->busTime < 80 );
+    CHECK( micros() - start == pStats->busTime );
+}
+
+// Register file and expander for the cache tests away from the
+// addresses used by the oscillator and the display
+#define CACHE_ADDR      0x61
+#define EXPANDER_ADDR   0x20
+
+// Writes of known values are suppressed and known values are read
+// back without using the bus
+static void testCache( void )
+{
+    static struct sSi5351Sim regFile;
+    static uint8_t regs[8], valid[I2C_CACHE_VALID_LEN(8)];
+    static struct sI2CCache cache = { CACHE_ADDR, 10, 8, false, regs, valid, 0 };
+    const uint8_t data[] = { 1, 2, 3, 4 };
+    const uint8_t changed[] = { 1, 2, 5, 4 };
+    const struct sI2CSimStats *pStats = i2cSimGetStats();
+    uint8_t value;
+
+    i2cSimSi5351Init( &regFile, CACHE_ADDR );
+    i2cSimAttach( &regFile.dev );
+    i2cCacheAdd( &cache );
+
+    // Unknown registers are all sent
+    i2cSimResetStats();
+    CHECK( i2cCacheWriteRegisters( CACHE_ADDR, 10, data, sizeof(data) ) == 0 );
+    CHECK( pStats->transactions == 1 );
+    CHECK( pStats->bytes == 2 + sizeof(data) );
+    CHECK( memcmp( &regFile.regs[10], data, sizeof(data) ) == 0 );
+
+    // Writing the same values again sends nothing
+    i2cSimResetStats();
+    CHECK( i2cCacheWriteRegisters( CACHE_ADDR, 10, data, sizeof(data) ) == 0 );
+    CHECK( i2cCacheWriteRegister( CACHE_ADDR, 11, 2 ) == 0 );
+    CHECK( pStats->transactions == 0 );
+
+    // Only the changed register is sent
+    CHECK( i2cCacheWriteRegisters( CACHE_ADDR, 10, changed, sizeof(changed) ) == 0 );
+    CHECK( pStats->transactions == 1 );
+    CHECK( pStats->bytes == 3 );
+    CHECK( regFile.regs[12] == 5 );
+
+    // Known registers are read from RAM and unknown ones from the device
+    // after which they are known
+    i2cSimResetStats();
+    CHECK( i2cCacheReadRegister( CACHE_ADDR, 12, &value ) == 0 );
+    CHECK( value == 5 );
+    CHECK( pStats->transactions == 0 );
+    regFile.regs[15] = 0x55;
+    CHECK( i2cCacheReadRegister( CACHE_ADDR, 15, &value ) == 0 );
+    CHECK( value == 0x55 );
+    CHECK( pStats->transactions == 1 );
+    CHECK( i2cCacheReadRegister( CACHE_ADDR, 15, &value ) == 0 );
+    CHECK( pStats->transactions == 1 );
+
+    // After invalidating everything is sent and read again
+    i2cCacheInvalidate( CACHE_ADDR );
+    i2cSimResetStats();
+    CHECK( i2cCacheWriteRegisters( CACHE_ADDR, 10, changed, sizeof(changed) ) == 0 );
+    CHECK( pStats->transactions == 1 );
+    CHECK( pStats->bytes == 2 + sizeof(changed) );
+    CHECK( i2cCacheReadRegister( CACHE_ADDR, 15, &value ) == 0 );
+    CHECK( pStats->transactions == 2 );
+
+    // A single register can be forgotten
+    i2cCacheInvalidateRegister( CACHE_ADDR, 11 );
+    i2cSimResetStats();
+    CHECK( i2cCacheWriteRegisters( CACHE_ADDR, 10, changed, sizeof(changed) ) == 0 );
+    CHECK( pStats->transactions == 1 );
+    CHECK( pStats->bytes == 3 );
+
+    i2cSimDetach( &regFile.dev );
+}
+
+// A registerless device is sent the data alone
+static void testCacheRegisterless( void )
+{
+    static struct sLCDSim expander;
+    static uint8_t regs[1], valid[I2C_CACHE_VALID_LEN(1)];
+    static struct sI2CCache cache = { EXPANDER_ADDR, 0, 1, true, regs, valid, 0 };
+    const uint8_t data[] = { 0x08, 0x00 };
+    const struct sI2CSimStats *pStats = i2cSimGetStats();
+
+    i2cSimLCDInit( &expander, EXPANDER_ADDR );
+    i2cSimAttach( &expander.dev );
+    i2cCacheAdd( &cache );
+
+    // Address and data bytes
+    i2cSimResetStats();
+    CHECK( i2cWrite( EXPANDER_ADDR, data, sizeof(data) ) == 0 );
+    CHECK( pStats->transactions == 1 );
+    CHECK( pStats->bytes == 1 + sizeof(data) );
+    CHECK( expander.port == 0x00 );
+
+    i2cSimResetStats();
+    CHECK( i2cCacheWriteRegister( EXPANDER_ADDR, 0, 0x08 ) == 0 );
+    CHECK( pStats->transactions == 1 );
+    CHECK( pStats->bytes == 2 );
+    CHECK( expander.port == 0x08 );
+
+    // Unchanged so not sent
+    CHECK( i2cCacheWriteRegister( EXPANDER_ADDR, 0, 0x08 ) == 0 );
+    CHECK( pStats->transactions == 1 );
+
+    i2cSimDetach( &expander.dev );
+}
+
+// The PLL reset register clears itself and each reset is counted
+static void testPLLReset( void )
+{
+    uint16_t a = si.pllResetA;
+    uint16_t b = si.pllResetB;
+
+    i2cWriteRegister( SI5351A_I2C_ADDRESS, 177, 0xA0 );
+    CHECK( si.pllResetA == a + 1 );
+    CHECK( si.pllResetB == b + 1 );
+    CHECK( (si.regs[177] & 0xA0) == 0 );
+}
+
+// Drive the oscillator driver over the model
+static void testOsc( void )
+{
+    const struct sI2CSimStats *pStats = i2cSimGetStats();
+    uint16_t resets;
+
+    oscSetXtalFrequency( XTAL_FREQ );
+    CHECK( oscInit() );
+
+    // Outputs off and powered down
+    CHECK( si.regs[3] == (1 << NUM_CLOCKS) - 1 );
+    CHECK( si.regs[16] == 0x80 && si.regs[17] == 0x80 && si.regs[18] == 0x80 );
+
+    resets = si.pllResetA;
+    oscSetFrequency( 0, 7030000, 0 );
+    CHECK( si.regs[16] == 0x4F );
+    CHECK( si.pllResetA == resets + 1 );
+
+    // Setting the same frequency again only sends the register
+    // that latches the PLL
+    i2cSimResetStats();
+    oscSetFrequency( 0, 7030000, 0 );
+    CHECK( pStats->transactions == 1 );
+    CHECK( pStats->bytes == 3 );
+
+    // A small step only changes the PLL without a reset
+    resets = si.pllResetA;
+    oscSetFrequency( 0, 7030100, 0 );
+    CHECK( pStats->transactions > 0 );
+    CHECK( si.pllResetA == resets );
+
+    oscClockEnable( 0, true );
+    CHECK( si.regs[3] == (1 << NUM_CLOCKS) - 2 );
+    CHECK( clockError( &si, 0, XTAL_FREQ, 7030100 ) < HZ_BOUND( 7030100 ) );
+}
+
+// A change finishes within twice the settle time even when further
+// changes keep arriving, as from a tuning knob
+static void testSettle( void )
+{
+    uint32_t start;
+    uint32_t f = 7040000;
+    bool bPending = true;
+
+    // Make sure the next change resets the PLL
+    oscSetFrequency( 0, 14040000, 0 );
+
+    start = micros();
+    while( bPending && (micros() - start < 10000) )
+    {
+        oscSetFrequencyAsync( 0, f, 0 );
+        f += 10;
+        delayMicroseconds( 500 );
+        bPending = oscPoll();
+    }
+    CHECK( !bPending );
+
+    // Twice the settle time plus the polling interval and bus time
+    CHECK( micros() - start < 2 * 1000 + 500 + 200 );
+    CHECK( si.regs[16] == 0x4F );
+}
+
+// Text is written to the LCD by displayUpdate() a changed run at a time
+static void testDisplay( void )
+{
+    const struct sI2CSimStats *pStats = i2cSimGetStats();
+
+    displayInit();
+    CHECK( lcd.bFourBit );
+    CHECK( lcd.displayControl == 0x0C );
+
+    // Nothing is written until the update
+    i2cSimResetStats();
+    lcd.commands = 0;
+    lcd.data = 0;
+    displayText( 0, "7.030000 MHz", true );
+    displayText( 1, "USB", true );
+    CHECK( pStats->transactions == 0 );
+
+    CHECK( displayUpdate() );
+    CHECK( memcmp( &lcd.ddram[0x00], "7.030000 MHz    ", LCD_WIDTH ) == 0 );
+    CHECK( memcmp( &lcd.ddram[0x40], "                ", LCD_WIDTH ) == 0 );
+    CHECK( displayUpdate() );
+    CHECK( memcmp( &lcd.ddram[0x40], "USB             ", LCD_WIDTH ) == 0 );
+    CHECK( !displayUpdate() );
+
+    // Only the changed characters and moving the cursor to them and back.
+    // Each LCD byte is two nibbles of data, EN high and EN low with one
+    // more when RS changes. Each is a transaction of the expander address
+    // and the data. Data the same as the last nibble is not sent.
+    CHECK( lcd.data == 12 + 3 );
+    CHECK( lcd.commands == 2 * 2 );
+    CHECK( pStats->transactions <= (12 + 3 + 2 * 2) * 6 + 4 );
+    CHECK( pStats->bytes == 2 * pStats->transactions );
+
+    // A single changed character
+    i2cSimResetStats();
+    lcd.commands = 0;
+    lcd.data = 0;
+    displayText( 0, "7.030100 MHz", true );
+    CHECK( displayUpdate() );
+    CHECK( !displayUpdate() );
+    CHECK( memcmp( &lcd.ddram[0x00], "7.030100 MHz    ", LCD_WIDTH ) == 0 );
+    CHECK( lcd.data == 1 );
+    CHECK( lcd.commands == 2 );
+    CHECK( pStats->transactions == 3 * 6 + 2 );
+    CHECK( pStats->bytes == 2 * pStats->transactions );
+}
+
+// Clocks set together are worked out at once and written with a single
+// reset of both PLLs where separate calls reset a PLL for each clock
+static void testFrequencies( void )
+{
+    const struct sOscRequest band1[] = { { 0, 7030000, 0 }, { 1, 7030000, 1 }, { 2, 7100000, 0 } };
+    const struct sOscRequest band2[] = { { 0, 14030000, 0 }, { 1, 14030000, 1 }, { 2, 14100000, 0 } };
+    const struct sI2CSimStats *pStats = i2cSimGetStats();
+    uint16_t resetsA, resetsB;
+    uint32_t transactions;
+    uint8_t regs[256];
+
+    oscClockEnable( 1, true );
+    oscClockEnable( 2, true );
+
+    // Separately
+    oscSetFrequencies( band1, 3 );
+    resetsA = si.pllResetA;
+    resetsB = si.pllResetB;
+    i2cSimResetStats();
+    for( uint8_t i = 0 ; i < 3 ; i++ )
+    {
+        oscSetFrequency( band2[i].clock, band2[i].frequency, band2[i].q );
+    }
+    transactions = pStats->transactions;
+#ifndef OSC_PLANNER
+    // PLL A is reset for clocks 0 and 1 and PLL B for clock 2
+    CHECK( si.pllResetA == resetsA + 2 );
+    CHECK( si.pllResetB == resetsB + 1 );
+#endif
+    memcpy( regs, si.regs, sizeof(regs) );
+
+    // Together
+    oscSetFrequencies( band1, 3 );
+    resetsA = si.pllResetA;
+    resetsB = si.pllResetB;
+    i2cSimResetStats();
+    oscSetFrequencies( band2, 3 );
+    CHECK( si.pllResetA == resetsA + 1 );
+    CHECK( si.pllResetB == resetsB + 1 );
+    CHECK( pStats->transactions < transactions );
+
+    // To the same registers
+    CHECK( memcmp( regs, si.regs, sizeof(regs) ) == 0 );
+    for( uint8_t i = 0 ; i < 3 ; i++ )
+    {
+        CHECK( clockError( &si, band2[i].clock, XTAL_FREQ, band2[i].frequency ) < HZ_BOUND( band2[i].frequency ) );
+    }
+
+    // Nothing changes so there is no reset
+    resetsA = si.pllResetA;
+    oscSetFrequencies( band2, 3 );
+    CHECK( si.pllResetA == resetsA );
+}
+
+// Address of a second oscillator model
+#define SECOND_ADDR     0x62
+
+// Two chips with different crystals are driven independently
+static void testDevices( void )
+{
+    static struct sSi5351Sim si2;
+    static struct sOscDevice dev2;
+    uint8_t regs[256];
+
+    i2cSimSi5351Init( &si2, SECOND_ADDR );
+    i2cSimAttach( &si2.dev );
+
+    oscDevSetXtalFrequency( &dev2, 25000000 );
+    CHECK( oscDevInit( &dev2, SECOND_ADDR ) );
+    oscDevClockEnable( &dev2, 0, true );
+
+    // Setting one chip leaves the other alone
+    memcpy( regs, si.regs, sizeof(regs) );
+    oscDevSetFrequency( &dev2, 0, 10000000, 0 );
+    CHECK( memcmp( regs, si.regs, sizeof(regs) ) == 0 );
+    CHECK( clockError( &si2, 0, 25000000, 10000000 ) < HZ_BOUND( 10000000 ) );
+
+    memcpy( regs, si2.regs, sizeof(regs) );
+    oscSetFrequency( 0, 10000000, 0 );
+    CHECK( memcmp( regs, si2.regs, sizeof(regs) ) == 0 );
+    CHECK( clockError( &si, 0, XTAL_FREQ, 10000000 ) < HZ_BOUND( 10000000 ) );
+
+    // The same frequency from different crystals
+    CHECK( memcmp( &si.regs[26], &si2.regs[26], 8 ) != 0 );
+
+    i2cSimDetach( &si2.dev );
+}
+
+// Address with nothing on it
+#define MISSING_ADDR    0x63
+
+// The driver's default wait for the chip to initialise
+#define INIT_TIMEOUT_US 100000UL
+#define INIT_READ_US    10
+
+// Starting a missing chip or one stuck in its system initialisation
+// gives up after OSC_INIT_TIMEOUT_US, or after a fixed number of status
+// reads when the timer isn't running
+static void testInitTimeout( void )
+{
+    static struct sSi5351Sim si3;
+    static struct sOscDevice dev3;
+    uint32_t start;
+
+    start = micros();
+    CHECK( !oscDevInit( &dev3, MISSING_ADDR ) );
+    CHECK( micros() - start >= INIT_TIMEOUT_US );
+    CHECK( micros() - start < INIT_TIMEOUT_US + 1000 );
+
+    i2cSimSi5351Init( &si3, MISSING_ADDR );
+    si3.regs[0] = 0x80;
+    i2cSimAttach( &si3.dev );
+
+    start = micros();
+    CHECK( !oscDevInit( &dev3, MISSING_ADDR ) );
+    CHECK( micros() - start >= INIT_TIMEOUT_US );
+
+    i2cSimStopTimer( true );
+    i2cSimResetStats();
+    CHECK( !oscDevInit( &dev3, MISSING_ADDR ) );
+    CHECK( si3.dev.transactions == INIT_TIMEOUT_US / INIT_READ_US );
+    i2cSimStopTimer( false );
+
+    i2cSimDetach( &si3.dev );
+}
+
+// Output enable and first clock control registers
+#define CLK_ENABLE      3
+#define CLK0_CONTROL    16
+
+// An image powers down the outputs it enables above NUM_CLOCKS and
+// leaves the others alone
+static void testLoadImage( void )
+{
+    static const uint8_t enable7[] =
+    {
+        CLK_ENABLE, 0x7E,
+        OSC_IMAGE_END
+    };
+    static const uint8_t enable0[] =
+    {
+        CLK_ENABLE, 0xFE,
+        OSC_IMAGE_END
+    };
+    static struct sSi5351Sim si3;
+    static struct sOscDevice dev3;
+
+    i2cSimSi5351Init( &si3, MISSING_ADDR );
+    i2cSimAttach( &si3.dev );
+
+    si3.regs[CLK0_CONTROL + 7] = 0x4F;
+    CHECK( oscDevLoadImage( &dev3, MISSING_ADDR, enable7 ) );
+    CHECK( si3.regs[CLK0_CONTROL + 7] == 0x80 );
+    CHECK( si3.regs[CLK0_CONTROL] == 0x80 );
+    CHECK( si3.regs[CLK_ENABLE] == 0x7E );
+
+#if NUM_CLOCKS < 8
+    si3.regs[CLK0_CONTROL + 7] = 0x4F;
+    CHECK( oscDevLoadImage( &dev3, MISSING_ADDR, enable0 ) );
+    CHECK( si3.regs[CLK0_CONTROL + 7] == 0x4F );
+    CHECK( si3.regs[CLK_ENABLE] == 0xFE );
+#else
+    (void) enable0;
+#endif
+
+    i2cSimDetach( &si3.dev );
+}
+
+#ifdef OSC_FSK
+// Each symbol is sent on time as a write of just the PLL registers
+// that change, without a PLL reset
+static void testFsk( void )
+{
+    static const uint8_t symbols[] = { 1, 3, 0, 2, 3, 1 };
+    const uint16_t numSymbols = sizeof(symbols);
+    const uint64_t frequency = 14097100000ULL;
+    const uint32_t spacing = 1465;
+    const struct sI2CSimStats *pStats = i2cSimGetStats();
+    uint16_t resets;
+    double tone0;
+    uint32_t start;
+
+    oscClockEnable( 2, true );
+    CHECK( oscFskInit( 2, frequency, spacing, 4 ) );
+    resets = si.pllResetA + si.pllResetB;
+
+    // Tone 0 is within half a step of the PLL numerator
+    tone0 = i2cSimSi5351Frequency( &si, 2, XTAL_FREQ ) * 1000;
+    CHECK( tone0 > frequency - 250 && tone0 < frequency + 250 );
+
+    i2cSimResetStats();
+    start = millis();
+    CHECK( oscFskStart( symbols, numSymbols, 8192, 12 ) );
+    CHECK( oscFskBusy() );
+
+    for( uint16_t k = 0 ; k < numSymbols ; k++ )
+    {
+        double error;
+
+        // Just before the end of the symbol
+        while( millis() - start < (uint32_t)(k + 1) * 8192 / 12 - 2 )
+        {
+            delay( 1 );
+            oscPoll();
+        }
+
+        // The spacing is exact
+        error = i2cSimSi5351Frequency( &si, 2, XTAL_FREQ ) * 1000 - (tone0 + symbols[k] * spacing);
+        CHECK( error > -1 && error < 1 );
+
+        // One write per symbol of up to 3 registers
+        CHECK( pStats->transactions == k + 1u );
+        CHECK( pStats->bytes <= (k + 1u) * (2 + 3) );
+    }
+
+    while( oscFskBusy() )
+    {
+        delay( 1 );
+        oscPoll();
+    }
+    CHECK( millis() - start <= numSymbols * 8192 / 12 + 1 );
+    CHECK( si.pllResetA + si.pllResetB == resets );
+}
+#endif
+
+#ifdef OSC_SWEEP
+// A sweep only rewrites the PLL while the multisynth divider stays the
+// same and is split into parts with a PLL reset between them where it
+// has to change
+static void testSweep( void )
+{
+    const struct sI2CSimStats *pStats = i2cSimGetStats();
+    uint8_t ms[8];
+    uint16_t resets, steps, parts;
+    uint32_t f;
+
+    oscClockEnable( 2, true );
+
+    CHECK( oscSweepStart( 2, 3500000, 1000, 500 ) );
+    memcpy( ms, &si.regs[58], sizeof(ms) );
+    resets = si.pllResetB;
+    i2cSimResetStats();
+    steps = 0;
+    do
+    {
+        f = 3500000 + 1000 * steps;
+        CHECK( clockError( &si, 2, XTAL_FREQ, f ) < HZ_BOUND( f ) );
+        steps++;
+    } while( oscSweepNext() );
+    CHECK( steps == 501 );
+    CHECK( memcmp( ms, &si.regs[58], sizeof(ms) ) == 0 );
+    CHECK( si.pllResetB == resets );
+
+    // One write of the changed PLL registers a step
+    CHECK( pStats->transactions == 500 );
+    CHECK( pStats->bytes <= 500 * (2 + 8) );
+
+    // 1MHz to 30MHz needs several dividers
+    CHECK( oscSweepStart( 2, 1000000, 100000, 290 ) );
+    memcpy( ms, &si.regs[58], sizeof(ms) );
+    resets = si.pllResetB;
+    steps = 0;
+    parts = 1;
+    do
+    {
+        f = 1000000 + 100000 * steps;
+        CHECK( clockError( &si, 2, XTAL_FREQ, f ) < HZ_BOUND( f ) );
+        if( memcmp( ms, &si.regs[58], sizeof(ms) ) != 0 )
+        {
+            memcpy( ms, &si.regs[58], sizeof(ms) );
+            parts++;
+        }
+        steps++;
+    } while( oscSweepNext() );
+    CHECK( steps == 291 );
+    CHECK( parts > 2 );
+    CHECK( si.pllResetB - resets == parts - 1 );
+
+    // Down as well as up
+    CHECK( oscSweepStart( 2, 30000000, -100000, 200 ) );
+    steps = 0;
+    do
+    {
+        f = 30000000 - 100000 * steps;
+        CHECK( clockError( &si, 2, XTAL_FREQ, f ) < HZ_BOUND( f ) );
+        steps++;
+    } while( oscSweepNext() );
+    CHECK( steps == 201 );
+
+    // Beyond 200MHz
+    CHECK( !oscSweepStart( 2, 100000000, 1000000, 200 ) );
+}
+#endif
+
+#if defined(OSC_PLANNER) && (NUM_CLOCKS > 6)
+// Clocks 6 and 7 only take even integer dividers so are powered down
+// when neither PLL gives one and come back when set again
+static void testPlanner( void )
+{
+    for( uint8_t clock = 0 ; clock < NUM_CLOCKS ; clock++ )
+    {
+        oscClockEnable( clock, true );
+    }
+
+    // Quadrature on one PLL and clock 6 on the other
+    oscSetFrequency( 0, 7100000, 0 );
+    oscSetFrequency( 1, 7100000, 1 );
+    oscSetFrequency( 6, 10000000, 0 );
+    CHECK( clockError( &si, 6, XTAL_FREQ, 10000000 ) < HZ_BOUND( 10000000 ) );
+
+    // Leave nothing for clock 7 at 13.37MHz
+    CHECK( oscSetFrequencyMilliHz( 7, 13370000000ULL, 0 ) == 0 );
+    CHECK( (si.regs[23] & 0x80) == 0x80 );
+    CHECK( i2cSimSi5351Frequency( &si, 7, XTAL_FREQ ) == 0 );
+
+    // The others are untouched
+    CHECK( clockError( &si, 0, XTAL_FREQ, 7100000 ) < HZ_BOUND( 7100000 ) );
+    CHECK( clockError( &si, 1, XTAL_FREQ, 7100000 ) < HZ_BOUND( 7100000 ) );
+    CHECK( clockError( &si, 6, XTAL_FREQ, 10000000 ) < HZ_BOUND( 10000000 ) );
+
+    // A frequency the PLL of clock 6 gives
+    oscSetFrequency( 7, 20000000, 0 );
+    CHECK( (si.regs[23] & 0x80) == 0 );
+    CHECK( clockError( &si, 7, XTAL_FREQ, 20000000 ) < HZ_BOUND( 20000000 ) );
+}
+#endif
+
+#ifdef I2C_ASYNC
+
+// Bus time of a write of n bytes including the address at 400kHz
+#define WRITE_US( n )   (((n) * 9 + 2) * 10 / 4 + 1)
+
+// Order and time the transactions completed in
+static struct sI2CTransaction *doneOrder[8];
+static uint32_t doneTime[8];
+static uint8_t numDone;
+
+static void recordDone( struct sI2CTransaction *pTrans )
+{
+    if( numDone < 8 )
+    {
+        doneTime[numDone] = micros();
+        doneOrder[numDone++] = pTrans;
+    }
+}
+
+// Set up a transaction to write a block of data
+static void setupWrite( struct sI2CTransaction *pTrans, uint8_t addr, bool bNoReg, uint8_t *buf, uint8_t len )
+{
+    memset( pTrans, 0, sizeof(*pTrans) );
+    pTrans->addr = addr;
+    pTrans->reg = 26;
+    pTrans->bNoReg = bNoReg;
+    pTrans->buf = buf;
+    pTrans->len = len;
+    pTrans->priority = bNoReg ? I2C_PRIORITY_LOW : I2C_PRIORITY_HIGH;
+    pTrans->callback = recordDone;
+}
+
+// An oscillator write queued behind display traffic goes next
+static void testPriority( void )
+{
+    static uint8_t expander[40];
+    static uint8_t pll[8];
+    struct sI2CTransaction display[3], osc;
+    uint32_t start;
+
+    // Backlight on with EN low so the LCD ignores it
+    memset( expander, 0x08, sizeof(expander) );
+    memcpy( pll, &si.regs[26], sizeof(pll) );
+
+    numDone = 0;
+    start = micros();
+    for( uint8_t i = 0 ; i < 3 ; i++ )
+    {
+        setupWrite( &display[i], LCD_I2C_ADDRESS, true, expander, sizeof(expander) );
+        CHECK( i2cQueue( &display[i] ) );
+    }
+    setupWrite( &osc, SI5351A_I2C_ADDRESS, false, pll, sizeof(pll) );
+    CHECK( i2cQueue( &osc ) );
+
+    CHECK( display[0].status == I2C_STATUS_ACTIVE );
+    CHECK( osc.status == I2C_STATUS_QUEUED );
+
+    CHECK( i2cWait( &display[2] ) == 0 );
+    CHECK( !i2cBusy() );
+
+    // The oscillator only waits for the display write on the bus
+    CHECK( numDone == 4 );
+    CHECK( doneOrder[0] == &display[0] );
+    CHECK( doneOrder[1] == &osc );
+    CHECK( doneOrder[2] == &display[1] );
+    CHECK( doneOrder[3] == &display[2] );
+    CHECK( doneTime[1] - start <= WRITE_US( 1 + 40 ) + WRITE_US( 2 + 8 ) );
+}
+
+// The oscillator write queued by the tick
+static struct sI2CTransaction tickOsc;
+static uint8_t tickPll[8];
+static uint32_t tickQueued, tickLatency, tickWrites;
+
+static void tickDone( struct sI2CTransaction *pTrans )
+{
+    uint32_t latency = micros() - tickQueued;
+
+    (void) pTrans;
+    if( latency > tickLatency )
+    {
+        tickLatency = latency;
+    }
+    tickWrites++;
+}
+
+// Queue an oscillator write each millisecond as FSK does
+static void tickQueue( void )
+{
+    if( (tickOsc.status != I2C_STATUS_QUEUED) && (tickOsc.status != I2C_STATUS_ACTIVE) )
+    {
+        tickQueued = micros();
+        i2cQueue( &tickOsc );
+    }
+}
+
+// Under continuous display updates the tuning latency is bounded by
+// one display transaction and the changes to the display are merged
+static void testPriorityDisplay( void )
+{
+    char text[LCD_WIDTH + 1];
+    uint16_t data;
+
+    memcpy( tickPll, &si.regs[26], sizeof(tickPll) );
+    setupWrite( &tickOsc, SI5351A_I2C_ADDRESS, false, tickPll, sizeof(tickPll) );
+    tickOsc.callback = tickDone;
+    tickLatency = 0;
+    tickWrites = 0;
+    millisSetTickCallback( tickQueue );
+
+    // Only the last of several texts is written and only the
+    // characters that differ from the LCD
+    displayText( 0, " 7000000 Hz", true );
+    while( displayUpdate() );
+    lcd.data = 0;
+    for( uint32_t i = 0 ; i < 50 ; i++ )
+    {
+        sprintf( text, "%8" PRIu32 " Hz", 7000000 + i * 10 );
+        displayText( 0, text, true );
+    }
+    while( displayUpdate() );
+    CHECK( lcd.data == 2 );
+    CHECK( memcmp( &lcd.ddram[0x00], " 7000490 Hz     ", LCD_WIDTH ) == 0 );
+
+    // Keep the display busy
+    for( uint32_t i = 0 ; i < 200 ; i++ )
+    {
+        sprintf( text, "%8" PRIu32 " Hz", 7000000 + i * 1111 );
+        displayText( 0, text, true );
+        displayText( 1, (i & 1) ? "USB" : "LSB", true );
+        while( displayUpdate() );
+    }
+    data = lcd.data;
+
+    millisSetTickCallback( 0 );
+    i2cWait( &tickOsc );
+
+    CHECK( data > 200 );
+    CHECK( tickWrites > 100 );
+    CHECK( tickLatency <= WRITE_US( 1 + 1 ) + WRITE_US( 2 + 8 ) );
+    CHECK( memcmp( &lcd.ddram[0x40], "USB             ", LCD_WIDTH ) == 0 );
+}
+
+#endif
+
+int main( void )
+{
+    i2cInit();
+    i2cSetClock( I2C_CLOCK_RATE );
+
+    i2cSimSi5351Init( &si, SI5351A_I2C_ADDRESS );
+    i2cSimAttach( &si.dev );
+    i2cSimLCDInit( &lcd, LCD_I2C_ADDRESS );
+    i2cSimAttach( &lcd.dev );
+
+    testRegisters();
+    testTime();
+    testPLLReset();
+    testCache();
+    testCacheRegisterless();
+    testOsc();
+    testSettle();
+    testDisplay();
+    testFrequencies();
+    testDevices();
+    testInitTimeout();
+    testLoadImage();
+#ifdef OSC_FSK
+    testFsk();
+#endif
+#ifdef OSC_SWEEP
+    testSweep();
+#endif
+#if defined(OSC_PLANNER) && (NUM_CLOCKS > 6)
+    testPlanner();
+#endif
+#ifdef I2C_ASYNC
+    testPriority();
+    testPriorityDisplay();
+#endif
+
+    if( failures )
+    {
+        printf( "test_sim: %d failed\n", failures );
+        return 1;
+    }
+
+    printf( "test_sim: passed\n" );
+    return 0;
+}
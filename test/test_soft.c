@@ -0,0 +1,153 @@
+/*
+ * test_soft.c
+ *
+ * Drives the bit-banged I2C master in i2c_soft.c over the simulated
+ * bit-banged bus, including a slave holding the bus.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "config.h"
+#include "i2c.h"
+#include "i2c_sim.h"
+#include "i2c_soft.h"
+#include "millis.h"
+
+static int failures;
+
+#define CHECK( cond )                                                       \
+    do                                                                      \
+    {                                                                       \
+        if( !(cond) )                                                       \
+        {                                                                   \
+            printf( "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond ); \
+            failures++;                                                     \
+        }                                                                   \
+    } while( 0 )
+
+// Defaults in i2c_soft.c
+#define HALF_US         5
+#define STRETCH_LIMIT   200
+
+#define REG_ADDR        0x60
+#define EXPANDER_ADDR   0x27
+
+static struct sSi5351Sim regFile;
+static struct sLCDSim expander;
+
+// Register writes and reads reach the model a bit at a time
+static void testTransfer( void )
+{
+    const uint8_t data[] = { 0x12, 0x80, 0x01, 0xFF };
+    uint8_t buf[4];
+    uint8_t value = 0x08;
+
+    CHECK( i2cSoftWriteRegisters( REG_ADDR, 26, data, sizeof(data) ) == 0 );
+    CHECK( memcmp( &regFile.regs[26], data, sizeof(data) ) == 0 );
+    CHECK( regFile.dev.transactions == 1 );
+    CHECK( regFile.dev.bytes == 2 + sizeof(data) );
+
+    memset( buf, 0, sizeof(buf) );
+    CHECK( i2cSoftReadRegisters( REG_ADDR, 26, buf, sizeof(buf) ) == 0 );
+    CHECK( memcmp( buf, data, sizeof(data) ) == 0 );
+
+    CHECK( i2cSoftWriteRegister( REG_ADDR, 3, 0x5A ) == 0 );
+    CHECK( i2cSoftReadRegister( REG_ADDR, 3, &value ) == 0 );
+    CHECK( value == 0x5A );
+
+    // No register address for the expander
+    CHECK( i2cSoftWrite( EXPANDER_ADDR, &value, 1 ) == 0 );
+    CHECK( expander.port == 0x5A );
+    CHECK( expander.dev.bytes == 2 );
+}
+
+// The step that failed is returned when a byte isn't acknowledged
+static void testNack( void )
+{
+    uint8_t value;
+
+    CHECK( i2cSoftWriteRegister( 0x50, 0, 0 ) == 2 );
+    CHECK( i2cSoftReadRegister( 0x50, 0, &value ) == 2 );
+
+    // The bus is still usable
+    CHECK( i2cSoftWriteRegister( REG_ADDR, 4, 0x33 ) == 0 );
+    CHECK( regFile.regs[4] == 0x33 );
+}
+
+// A slave holding SDA is clocked until it lets go
+static void testStuckSDA( void )
+{
+    uint8_t value = 0;
+
+    // Released after a few clocks so the start fails but the
+    // recovery frees the bus
+    i2cSimSoftHoldSDA( 5 );
+    CHECK( i2cSoftWriteRegister( REG_ADDR, 5, 0x44 ) == 1 );
+    CHECK( i2cSimSoftHigh( I2C_SIM_SDA ) );
+    CHECK( i2cSoftWriteRegister( REG_ADDR, 5, 0x44 ) == 0 );
+    CHECK( regFile.regs[5] == 0x44 );
+
+    // A read recovers in the same way
+    i2cSimSoftHoldSDA( 3 );
+    CHECK( i2cSoftReadRegisters( REG_ADDR, 5, &value, 1 ) == 1 );
+    CHECK( i2cSimSoftHigh( I2C_SIM_SDA ) );
+    CHECK( i2cSoftReadRegisters( REG_ADDR, 5, &value, 1 ) == 0 );
+    CHECK( value == 0x44 );
+
+    // Never released
+    i2cSimSoftHoldSDA( 0xFF );
+    CHECK( i2cSoftWriteRegister( REG_ADDR, 5, 0x45 ) == I2C_ERROR_SDA_STUCK );
+    i2cSimSoftHoldSDA( 0 );
+    CHECK( i2cSoftWriteRegister( REG_ADDR, 5, 0x45 ) == 0 );
+    CHECK( regFile.regs[5] == 0x45 );
+}
+
+// Clock stretching up to the limit is waited for
+static void testStuckSCL( void )
+{
+    uint32_t start;
+
+    // Short stretch
+    i2cSimSoftHoldSCL( 10 * HALF_US );
+    CHECK( i2cSoftWriteRegister( REG_ADDR, 7, 0x11 ) == 0 );
+    CHECK( regFile.regs[7] == 0x11 );
+
+    // Longer than the limit but released by the time of the recovery
+    i2cSimSoftHoldSCL( (STRETCH_LIMIT + 1) * HALF_US + 2 );
+    CHECK( i2cSoftWriteRegister( REG_ADDR, 7, 0x22 ) == I2C_ERROR_TIMEOUT );
+    CHECK( i2cSoftWriteRegister( REG_ADDR, 7, 0x22 ) == 0 );
+    CHECK( regFile.regs[7] == 0x22 );
+
+    // Held for good and the wait is bounded
+    start = micros();
+    i2cSimSoftHoldSCL( 1000000 );
+    CHECK( i2cSoftWriteRegister( REG_ADDR, 7, 0x33 ) == I2C_ERROR_SCL_STUCK );
+    CHECK( micros() - start < (STRETCH_LIMIT + 10) * HALF_US );
+    CHECK( regFile.regs[7] == 0x22 );
+}
+
+int main( void )
+{
+    i2cSoftInit();
+
+    i2cSimSi5351Init( &regFile, REG_ADDR );
+    i2cSimSoftAttach( &regFile.dev );
+    i2cSimLCDInit( &expander, EXPANDER_ADDR );
+    i2cSimSoftAttach( &expander.dev );
+
+    testTransfer();
+    testNack();
+    testStuckSDA();
+    testStuckSCL();
+
+    if( failures )
+    {
+        printf( "test_soft: %d failed\n", failures );
+        return 1;
+    }
+
+    printf( "test_soft: passed\n" );
+    return 0;
+}